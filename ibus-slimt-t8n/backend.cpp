@@ -0,0 +1,279 @@
+#include "ibus-slimt-t8n/backend.h"
+#include <algorithm>
+#include <glib.h>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+// Copies the candidates of table into candidates, reusing its strings.
+void snapshot(const g::LookupTable &table,
+              std::vector<std::string> &candidates) {
+  candidates.resize(table.size());
+  for (guint i = 0; i < table.size(); i++) {
+    candidates[i].assign(table.get_candidate(i)->text);
+  }
+}
+
+} // namespace
+
+RecordingBackend::Event &RecordingBackend::record(Call call) {
+  Event event;
+  event.call = call;
+  event.time = std::chrono::steady_clock::now();
+  events_.push_back(std::move(event));
+  return events_.back();
+}
+
+void RecordingBackend::commit_text(const g::Text &text) {
+  record(Call::CommitText).text = text.text();
+}
+
+void RecordingBackend::update_preedit_text(const g::Text &text, guint cursor,
+                                           gboolean visible) {
+  Event &event = record(Call::UpdatePreeditText);
+  event.text = text.text();
+  event.cursor = cursor;
+  event.visible = visible;
+}
+
+void RecordingBackend::show_preedit_text() { record(Call::ShowPreeditText); }
+
+void RecordingBackend::hide_preedit_text() { record(Call::HidePreeditText); }
+
+void RecordingBackend::update_auxiliary_text(const g::Text &text,
+                                             gboolean visible) {
+  Event &event = record(Call::UpdateAuxiliaryText);
+  event.text = text.text();
+  event.visible = visible;
+}
+
+void RecordingBackend::show_auxiliary_text() {
+  record(Call::ShowAuxiliaryText);
+}
+
+void RecordingBackend::hide_auxiliary_text() {
+  record(Call::HideAuxiliaryText);
+}
+
+void RecordingBackend::update_lookup_table(const g::LookupTable &table,
+                                           gboolean visible) {
+  Event &event = record(Call::UpdateLookupTable);
+  event.visible = visible;
+  for (guint i = 0; i < table.size(); i++) {
+    event.candidates.emplace_back(table.get_candidate(i)->text);
+  }
+}
+
+void RecordingBackend::update_lookup_table_fast(const g::LookupTable &table,
+                                                gboolean visible) {
+  update_lookup_table(table, visible);
+}
+
+void RecordingBackend::show_lookup_table() { record(Call::ShowLookupTable); }
+
+void RecordingBackend::hide_lookup_table() { record(Call::HideLookupTable); }
+
+void RecordingBackend::register_properties(const g::PropList & /*props*/) {
+  record(Call::RegisterProperties);
+}
+
+void RecordingBackend::update_property(const g::Property & /*prop*/) {
+  record(Call::UpdateProperty);
+}
+
+CoalescingBackend::CoalescingBackend(std::unique_ptr<Backend> backend,
+                                     std::chrono::milliseconds interval)
+    : backend_(std::move(backend)), interval_(interval) {}
+
+CoalescingBackend::~CoalescingBackend() {
+  // The last state the engine asked for still goes out.
+  flush();
+}
+
+void CoalescingBackend::schedule() {
+  if (timer_ != 0) {
+    return;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto since = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - flushed_);
+  auto delay = std::max(interval_ - since, std::chrono::milliseconds(0));
+  timer_ = g_timeout_add(
+      static_cast<guint>(delay.count()),
+      +[](gpointer data) -> gboolean {
+        auto *backend = static_cast<CoalescingBackend *>(data);
+        backend->timer_ = 0;
+        backend->flush();
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+void CoalescingBackend::flush() {
+  if (timer_ != 0) {
+    g_source_remove(timer_);
+    timer_ = 0;
+  }
+  size_t sent = stats_.sent;
+
+  // Text and cursor go with a full update, which carries visibility along.
+  // Visibility alone is a show or a hide.
+  if (preedit_text_ and (preedit_.text != sent_preedit_.text or
+                         preedit_.cursor != sent_preedit_.cursor)) {
+    backend_->update_preedit_text(*preedit_text_, preedit_.cursor,
+                                  static_cast<gboolean>(preedit_.visible));
+    ++stats_.sent;
+  } else if (preedit_.visible != sent_preedit_.visible) {
+    if (preedit_.visible) {
+      backend_->show_preedit_text();
+    } else {
+      backend_->hide_preedit_text();
+    }
+    ++stats_.sent;
+  }
+  sent_preedit_ = preedit_;
+
+  // Same for the lookup table.
+  if (lookup_table_ and table_.candidates != sent_table_.candidates) {
+    auto visible = static_cast<gboolean>(table_.visible);
+    if (table_.fast) {
+      backend_->update_lookup_table_fast(*lookup_table_, visible);
+    } else {
+      backend_->update_lookup_table(*lookup_table_, visible);
+    }
+    ++stats_.sent;
+  } else if (table_.visible != sent_table_.visible) {
+    if (table_.visible) {
+      backend_->show_lookup_table();
+    } else {
+      backend_->hide_lookup_table();
+    }
+    ++stats_.sent;
+  }
+  sent_table_ = table_;
+
+  // The interval runs from the last message, an empty flush does not count.
+  if (stats_.sent != sent) {
+    flushed_ = std::chrono::steady_clock::now();
+  }
+}
+
+void CoalescingBackend::forget() {
+  flush();
+
+  // Nothing is wanted on screen either, or the next flush would show the old
+  // client's preedit and candidates to the new one. clear() keeps the
+  // capacity of the strings.
+  preedit_.text.clear();
+  preedit_.cursor = 0;
+  preedit_.visible = false;
+  preedit_text_.reset();
+  table_.candidates.clear();
+  table_.visible = false;
+  table_.fast = false;
+  lookup_table_.reset();
+
+  sent_preedit_ = preedit_;
+  sent_table_ = table_;
+}
+
+void CoalescingBackend::commit_text(const g::Text &text) {
+  ++stats_.received;
+  flush();
+  backend_->commit_text(text);
+  ++stats_.sent;
+
+  // What follows a commit, usually clearing the preedit, should not lag a
+  // frame behind it.
+  flushed_ = {};
+}
+
+void CoalescingBackend::update_preedit_text(const g::Text &text, guint cursor,
+                                            gboolean visible) {
+  ++stats_.received;
+  preedit_.text.assign(text.text());
+  preedit_.cursor = cursor;
+  preedit_.visible = visible != FALSE;
+  preedit_text_ = text;
+  schedule();
+}
+
+void CoalescingBackend::show_preedit_text() {
+  ++stats_.received;
+  preedit_.visible = true;
+  schedule();
+}
+
+void CoalescingBackend::hide_preedit_text() {
+  ++stats_.received;
+  preedit_.visible = false;
+  schedule();
+}
+
+void CoalescingBackend::update_auxiliary_text(const g::Text &text,
+                                              gboolean visible) {
+  ++stats_.received;
+  flush();
+  backend_->update_auxiliary_text(text, visible);
+  ++stats_.sent;
+}
+
+void CoalescingBackend::show_auxiliary_text() {
+  ++stats_.received;
+  flush();
+  backend_->show_auxiliary_text();
+  ++stats_.sent;
+}
+
+void CoalescingBackend::hide_auxiliary_text() {
+  ++stats_.received;
+  flush();
+  backend_->hide_auxiliary_text();
+  ++stats_.sent;
+}
+
+void CoalescingBackend::update_lookup_table(const g::LookupTable &table,
+                                            gboolean visible) {
+  ++stats_.received;
+  snapshot(table, table_.candidates);
+  table_.visible = visible != FALSE;
+  table_.fast = false;
+  lookup_table_ = table;
+  schedule();
+}
+
+void CoalescingBackend::update_lookup_table_fast(const g::LookupTable &table,
+                                                 gboolean visible) {
+  update_lookup_table(table, visible);
+  table_.fast = true;
+}
+
+void CoalescingBackend::show_lookup_table() {
+  ++stats_.received;
+  table_.visible = true;
+  schedule();
+}
+
+void CoalescingBackend::hide_lookup_table() {
+  ++stats_.received;
+  table_.visible = false;
+  schedule();
+}
+
+void CoalescingBackend::register_properties(const g::PropList &props) {
+  ++stats_.received;
+  flush();
+  backend_->register_properties(props);
+  ++stats_.sent;
+}
+
+void CoalescingBackend::update_property(const g::Property &prop) {
+  ++stats_.received;
+  flush();
+  backend_->update_property(prop);
+  ++stats_.sent;
+}
+
+} // namespace ibus::slimt::t8n
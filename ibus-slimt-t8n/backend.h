@@ -0,0 +1,259 @@
+#pragma once
+#include <ibus.h>
+
+#include "ibus-slimt-t8n/gtypes.h"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Everything an Engine sends out: commits, preedit, auxiliary text, lookup
+// table and properties. IBusBackend forwards to the IBus daemon, other
+// implementations allow driving an engine without one.
+class Backend {
+public:
+  virtual ~Backend() = default;
+
+  virtual void commit_text(const g::Text &text) = 0;
+
+  virtual void update_preedit_text(const g::Text &text, guint cursor,
+                                   gboolean visible) = 0;
+  virtual void show_preedit_text() = 0;
+  virtual void hide_preedit_text() = 0;
+
+  virtual void update_auxiliary_text(const g::Text &text, gboolean visible) = 0;
+  virtual void show_auxiliary_text() = 0;
+  virtual void hide_auxiliary_text() = 0;
+
+  virtual void update_lookup_table(const g::LookupTable &table,
+                                   gboolean visible) = 0;
+  virtual void update_lookup_table_fast(const g::LookupTable &table,
+                                        gboolean visible) = 0;
+  virtual void show_lookup_table() = 0;
+  virtual void hide_lookup_table() = 0;
+
+  virtual void register_properties(const g::PropList &props) = 0;
+  virtual void update_property(const g::Property &prop) = 0;
+};
+
+class IBusBackend : public Backend {
+public:
+  explicit IBusBackend(IBusEngine *engine) : engine_(engine) {}
+
+  void commit_text(const g::Text &text) override {
+    ibus_engine_commit_text(engine_, text.get());
+  }
+
+  void update_preedit_text(const g::Text &text, guint cursor,
+                           gboolean visible) override {
+    ibus_engine_update_preedit_text(engine_, text.get(), cursor, visible);
+  }
+
+  void show_preedit_text() override { ibus_engine_show_preedit_text(engine_); }
+
+  void hide_preedit_text() override { ibus_engine_hide_preedit_text(engine_); }
+
+  void update_auxiliary_text(const g::Text &text, gboolean visible) override {
+    ibus_engine_update_auxiliary_text(engine_, text.get(), visible);
+  }
+
+  void show_auxiliary_text() override {
+    ibus_engine_show_auxiliary_text(engine_);
+  }
+
+  void hide_auxiliary_text() override {
+    ibus_engine_hide_auxiliary_text(engine_);
+  }
+
+  void update_lookup_table(const g::LookupTable &table,
+                           gboolean visible) override {
+    ibus_engine_update_lookup_table(engine_, table.get(), visible);
+  }
+
+  void update_lookup_table_fast(const g::LookupTable &table,
+                                gboolean visible) override {
+    ibus_engine_update_lookup_table_fast(engine_, table.get(), visible);
+  }
+
+  void show_lookup_table() override { ibus_engine_show_lookup_table(engine_); }
+
+  void hide_lookup_table() override { ibus_engine_hide_lookup_table(engine_); }
+
+  void register_properties(const g::PropList &props) override {
+    ibus_engine_register_properties(engine_, props.get());
+  }
+
+  void update_property(const g::Property &prop) override {
+    ibus_engine_update_property(engine_, prop.get());
+  }
+
+private:
+  IBusEngine *engine_;
+};
+
+// Keeps every call in memory with a timestamp, for tests and benchmarks that
+// drive an engine in-process.
+class RecordingBackend : public Backend {
+public:
+  enum class Call {
+    CommitText,
+    UpdatePreeditText,
+    ShowPreeditText,
+    HidePreeditText,
+    UpdateAuxiliaryText,
+    ShowAuxiliaryText,
+    HideAuxiliaryText,
+    UpdateLookupTable,
+    ShowLookupTable,
+    HideLookupTable,
+    RegisterProperties,
+    UpdateProperty
+  };
+
+  struct Event {
+    Call call;
+    std::chrono::steady_clock::time_point time;
+
+    // Committed, preedit or auxiliary text.
+    std::string text;
+    guint cursor = 0;
+    gboolean visible = FALSE;
+
+    // Lookup table contents.
+    std::vector<std::string> candidates;
+  };
+
+  const std::vector<Event> &events() const { return events_; }
+  void clear() { events_.clear(); }
+
+  void commit_text(const g::Text &text) override;
+
+  void update_preedit_text(const g::Text &text, guint cursor,
+                           gboolean visible) override;
+  void show_preedit_text() override;
+  void hide_preedit_text() override;
+
+  void update_auxiliary_text(const g::Text &text, gboolean visible) override;
+  void show_auxiliary_text() override;
+  void hide_auxiliary_text() override;
+
+  void update_lookup_table(const g::LookupTable &table,
+                           gboolean visible) override;
+  void update_lookup_table_fast(const g::LookupTable &table,
+                                gboolean visible) override;
+  void show_lookup_table() override;
+  void hide_lookup_table() override;
+
+  void register_properties(const g::PropList &props) override;
+  void update_property(const g::Property &prop) override;
+
+private:
+  Event &record(Call call);
+
+  std::vector<Event> events_;
+};
+
+// Sits in front of another backend and passes on only what would change on
+// screen. Every D-Bus message to the panel and the client costs a round trip,
+// and an engine refreshing on every key sends the same preedit and lookup
+// table over and over.
+//
+// Updates to the preedit and the lookup table are collected and sent together
+// once the main loop gets back to it, at most once per interval. Anything
+// matching what was last sent is left out. Commits, auxiliary text and
+// properties go through at once, after whatever is pending, so nothing is
+// reordered around them.
+class CoalescingBackend : public Backend {
+public:
+  // A frame at 60 Hz.
+  static constexpr std::chrono::milliseconds kInterval{16};
+
+  explicit CoalescingBackend(std::unique_ptr<Backend> backend,
+                             std::chrono::milliseconds interval = kInterval);
+  ~CoalescingBackend() override;
+
+  CoalescingBackend(const CoalescingBackend &) = delete;
+  CoalescingBackend &operator=(const CoalescingBackend &) = delete;
+
+  struct Stats {
+    // Calls from the engine, and messages passed on for them. The rest
+    // repeated what was on screen already, or were overtaken by a later call
+    // within the same interval.
+    size_t received = 0;
+    size_t sent = 0;
+
+    size_t suppressed() const { return received - sent; }
+  };
+
+  const Stats &stats() const { return stats_; }
+
+  // Sends whatever is pending now.
+  void flush();
+
+  // For focus changes, after which IBus has hidden the preedit and the lookup
+  // table of its own accord: sends what is pending, then assumes nothing is
+  // on screen anymore, nor wanted there.
+  void forget();
+
+  void commit_text(const g::Text &text) override;
+
+  void update_preedit_text(const g::Text &text, guint cursor,
+                           gboolean visible) override;
+  void show_preedit_text() override;
+  void hide_preedit_text() override;
+
+  void update_auxiliary_text(const g::Text &text, gboolean visible) override;
+  void show_auxiliary_text() override;
+  void hide_auxiliary_text() override;
+
+  void update_lookup_table(const g::LookupTable &table,
+                           gboolean visible) override;
+  void update_lookup_table_fast(const g::LookupTable &table,
+                                gboolean visible) override;
+  void show_lookup_table() override;
+  void hide_lookup_table() override;
+
+  void register_properties(const g::PropList &props) override;
+  void update_property(const g::Property &prop) override;
+
+private:
+  struct Preedit {
+    std::string text;
+    guint cursor = 0;
+    bool visible = false;
+  };
+
+  struct Table {
+    std::vector<std::string> candidates;
+    bool visible = false;
+    bool fast = false;
+  };
+
+  // Arms the timer for the next flush, unless it already is.
+  void schedule();
+
+  std::unique_ptr<Backend> backend_;
+  std::chrono::milliseconds interval_;
+
+  // What the engine wants shown, with the objects to send for it, and what
+  // was last sent. Tables are compared by their candidates and visibility.
+  // Strings are assigned in place, so keeping them up to date does not
+  // allocate once they have grown.
+  Preedit preedit_;
+  std::optional<g::Text> preedit_text_;
+  Preedit sent_preedit_;
+
+  Table table_;
+  std::optional<g::LookupTable> lookup_table_;
+  Table sent_table_;
+
+  Stats stats_;
+  std::chrono::steady_clock::time_point flushed_;
+  guint timer_ = 0;
+};
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,333 @@
+#include "ibus-slimt-t8n/backend.h"
+#include "ibus-slimt-t8n/fake_translator.h"
+#include "ibus-slimt-t8n/slimt_engine.h"
+#include "ibus-slimt-t8n/translator.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Replays a corpus as if it were typed: every prefix of every line is
+// translated, the way the engine retranslates the buffer on every keystroke.
+// Input is read from stdin, in the same format the test REPL takes:
+//
+//    <source_lang> <target_lang> <input>
+//
+// Results are written to stdout as JSON.
+//
+// In engine mode, the corpus is instead fed key by key into a SlimtEngine
+// running in-process, which times the whole path from keystroke
+// to preedit: the key handler, the translator, the hop back onto the main
+// loop and the lookup table. engine-fake does the same on FakeTranslator,
+// which costs whatever the fake section of the config says, to time the
+// engine and its scheduling without models. Both engine modes also count
+// what the main loop allocates through operator new per key, which is what
+// our code allocates: GLib and IBus use malloc. Output is discarded rather
+// than recorded, so the count is the engine's alone.
+
+namespace {
+
+// Per thread, so work on the translator's threads is left out.
+thread_local size_t allocations = 0;
+
+} // namespace
+
+void *operator new(std::size_t size) {
+  ++allocations;
+  if (void *pointer = std::malloc(size != 0 ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept { std::free(pointer); }
+
+void operator delete(void *pointer, std::size_t /*size*/) noexcept {
+  std::free(pointer);
+}
+
+namespace {
+
+using ibus::slimt::t8n::Direction;
+using Clock = std::chrono::steady_clock;
+
+// Takes whatever the engine sends and does nothing with it.
+class NullBackend : public ibus::slimt::t8n::Backend {
+public:
+  void commit_text(const g::Text & /*text*/) override {}
+
+  void update_preedit_text(const g::Text & /*text*/, guint /*cursor*/,
+                           gboolean /*visible*/) override {}
+  void show_preedit_text() override {}
+  void hide_preedit_text() override {}
+
+  void update_auxiliary_text(const g::Text & /*text*/,
+                             gboolean /*visible*/) override {}
+  void show_auxiliary_text() override {}
+  void hide_auxiliary_text() override {}
+
+  void update_lookup_table(const g::LookupTable & /*table*/,
+                           gboolean /*visible*/) override {}
+  void update_lookup_table_fast(const g::LookupTable & /*table*/,
+                                gboolean /*visible*/) override {}
+  void show_lookup_table() override {}
+  void hide_lookup_table() override {}
+
+  void register_properties(const g::PropList & /*props*/) override {}
+  void update_property(const g::Property & /*prop*/) override {}
+};
+
+struct Sample {
+  Direction direction;
+  std::string text;
+};
+
+struct Report {
+  std::string mode;
+  size_t skipped = 0;
+  std::vector<double> latencies; // milliseconds
+  double seconds = 0;
+  // Through operator new on the main thread, over all requests. Engine
+  // modes only.
+  std::optional<size_t> allocations;
+};
+
+std::vector<Sample> read(std::istream &in) {
+  std::vector<Sample> samples;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream stream(line);
+    Sample sample;
+    stream >> sample.direction.source >> sample.direction.target;
+    std::getline(stream, sample.text);
+    if (!sample.direction.source.empty() && !sample.text.empty()) {
+      samples.push_back(std::move(sample));
+    }
+  }
+  return samples;
+}
+
+// Pivot through English: keep the non-English side of the sample and pair it
+// with some other non-English language the translator knows about.
+template <class Translator>
+std::optional<Direction> pivot(const Translator &translator,
+                               const Direction &direction) {
+  const std::string &keep =
+      (direction.source == "English") ? direction.target : direction.source;
+  for (const auto &lang : translator.languages().target) {
+    if (lang != "English" && lang != keep) {
+      return Direction{.source = keep, .target = lang};
+    }
+  }
+  return std::nullopt;
+}
+
+template <class Translator>
+Report run(const std::string &mode, const std::string &config,
+           const std::vector<Sample> &samples) {
+  // A fresh translator per mode, so the memo does not carry over.
+  Translator translator(config);
+  translator.set_verify(mode == "backtranslation");
+
+  Report report;
+  report.mode = mode;
+  Direction current;
+  auto start = Clock::now();
+  for (const Sample &sample : samples) {
+    std::optional<Direction> direction = sample.direction;
+    if (mode == "pivot") {
+      direction = pivot(translator, sample.direction);
+    }
+
+    if (!direction) {
+      ++report.skipped;
+      continue;
+    }
+
+    if (direction->source != current.source ||
+        direction->target != current.target) {
+      translator.set_direction(*direction);
+      translator.set_verify(mode == "backtranslation");
+      current = *direction;
+
+      // Models load in the background. Wait on them outside the clock.
+      auto warmup = Clock::now();
+      translator.translate(std::string());
+      start += Clock::now() - warmup;
+    }
+
+    for (size_t length = 1; length <= sample.text.size(); length++) {
+      std::string prefix = sample.text.substr(0, length);
+      auto before = Clock::now();
+      std::string target = translator.translate(prefix);
+      if (mode == "backtranslation") {
+        translator.backtranslate(target);
+      }
+      std::chrono::duration<double, std::milli> elapsed = Clock::now() - before;
+      report.latencies.push_back(elapsed.count());
+    }
+  }
+
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  report.seconds = elapsed.count();
+  return report;
+}
+
+// Time spent inside process_key_event(...), and time until the preedit shows
+// the translation of the buffer with that key in it.
+template <class Translator>
+std::vector<Report> run_engine(const std::vector<Sample> &samples) {
+  using ibus::slimt::t8n::BasicSlimtEngine;
+  BasicSlimtEngine<Translator> engine(std::make_unique<NullBackend>());
+  engine.focus_in();
+
+  Report keystroke;
+  keystroke.mode = "keystroke";
+  keystroke.allocations = 0;
+  Report preedit;
+  preedit.mode = "preedit";
+  preedit.allocations = 0;
+
+  // Results reach the engine through invoke_on_main(...), which queues them
+  // for the iterations below. Every engine call, on_translation(...)
+  // included, stays on this thread, as it would on the IBus main loop.
+  auto settle = [&engine]() {
+    while (engine.pending()) {
+      g_main_context_iteration(nullptr, TRUE);
+    }
+  };
+
+  Direction current;
+  std::chrono::duration<double> total{0};
+  for (const Sample &sample : samples) {
+    if (sample.direction.source != current.source ||
+        sample.direction.target != current.target) {
+      std::string source = "source_" + sample.direction.source;
+      std::string target = "target_" + sample.direction.target;
+      engine.property_activate(source.c_str(), 1);
+      engine.property_activate(target.c_str(), 1);
+      current = sample.direction;
+
+      // Wait for models to load outside the clock, same as the other modes.
+      engine.process_key_event('x', 0, 0);
+      settle();
+      engine.process_key_event(IBUS_BackSpace, 0, 0);
+    }
+
+    for (char c : sample.text) {
+      auto key = static_cast<unsigned char>(c);
+      if (!isprint(key)) {
+        ++keystroke.skipped;
+        ++preedit.skipped;
+        continue;
+      }
+
+      size_t allocated = allocations;
+      auto before = Clock::now();
+      engine.process_key_event(key, 0, 0);
+      auto handled = Clock::now();
+      *keystroke.allocations += allocations - allocated;
+      settle();
+      auto shown = Clock::now();
+      *preedit.allocations += allocations - allocated;
+
+      std::chrono::duration<double, std::milli> handler = handled - before;
+      std::chrono::duration<double, std::milli> latency = shown - before;
+      keystroke.latencies.push_back(handler.count());
+      preedit.latencies.push_back(latency.count());
+      total += shown - before;
+    }
+
+    // Ctrl-Enter commits the line and clears the buffer.
+    engine.process_key_event(IBUS_Return, 0, IBUS_CONTROL_MASK);
+  }
+
+  keystroke.seconds = total.count();
+  preedit.seconds = total.count();
+  engine.focus_out();
+  return {keystroke, preedit};
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  // Nearest rank.
+  auto rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+void print(std::ostream &out, const std::string &translator,
+           const std::vector<Report> &reports) {
+  out << "{\n";
+  out << "  \"translator\": \"" << translator << "\",\n";
+  out << "  \"modes\": [\n";
+  for (size_t i = 0; i < reports.size(); i++) {
+    const Report &report = reports[i];
+    std::vector<double> sorted = report.latencies;
+    std::sort(sorted.begin(), sorted.end());
+    double throughput =
+        report.seconds > 0 ? sorted.size() / report.seconds : 0;
+
+    out << "    {\n";
+    out << "      \"mode\": \"" << report.mode << "\",\n";
+    out << "      \"requests\": " << sorted.size() << ",\n";
+    out << "      \"skipped\": " << report.skipped << ",\n";
+    out << "      \"seconds\": " << report.seconds << ",\n";
+    out << "      \"throughput\": " << throughput << ",\n";
+    if (report.allocations) {
+      double average =
+          sorted.empty()
+              ? 0
+              : static_cast<double>(*report.allocations) / sorted.size();
+      out << "      \"allocations_per_request\": " << average << ",\n";
+    }
+    out << "      \"latency_ms\": {";
+    out << "\"p50\": " << percentile(sorted, 50) << ", ";
+    out << "\"p90\": " << percentile(sorted, 90) << ", ";
+    out << "\"p99\": " << percentile(sorted, 99) << ", ";
+    out << "\"max\": " << (sorted.empty() ? 0 : sorted.back()) << "}\n";
+    out << "    }" << (i + 1 < reports.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n";
+  out << "}\n";
+}
+
+template <class Translator>
+void bench(const std::string &name, const std::string &config) {
+  std::vector<Sample> samples = read(std::cin);
+  std::vector<Report> reports;
+  for (const char *mode : {"forward", "backtranslation", "pivot"}) {
+    reports.push_back(run<Translator>(mode, config, samples));
+  }
+  print(std::cout, name, reports);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string mode((argc == 2) ? argv[1] : "");
+  auto config = ibus::slimt::t8n::ibus_slimt_t8n_config();
+  if (mode == "fake") {
+    bench<ibus::slimt::t8n::FakeTranslator>(mode, config);
+  } else if (mode == "engine") {
+    std::vector<Sample> samples = read(std::cin);
+    print(std::cout, mode,
+          run_engine<ibus::slimt::t8n::Translator>(samples));
+  } else if (mode == "engine-fake") {
+    std::vector<Sample> samples = read(std::cin);
+    print(std::cout, mode,
+          run_engine<ibus::slimt::t8n::FakeTranslator>(samples));
+  } else {
+    bench<ibus::slimt::t8n::Translator>("real", config);
+  }
+
+  return 0;
+}
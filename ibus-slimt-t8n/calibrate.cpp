@@ -0,0 +1,237 @@
+#include "ibus-slimt-t8n/calibrate.h"
+#include "ibus-slimt-t8n/translator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "yaml-cpp/yaml.h"
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+// About what gets typed into an IME, in English. Models for other source
+// languages make little sense of it, but cost about the same per word.
+const std::vector<std::string> kSample = {
+    "Hello, how are you doing today?",
+    "I will be a few minutes late for the meeting.",
+    "Could you send me the report by the end of the week?",
+    "The weather has been lovely all weekend.",
+    "Thanks a lot for your help with the move.",
+    "Let me know if anything changes.",
+    "We are going to the market tomorrow morning, do you want to come along?",
+    "The train was delayed again because of the snow.",
+    "Please find the updated schedule attached to this message.",
+    "I think we should talk about this in person.",
+    "Dinner is at eight, don't forget to bring the wine.",
+    "Happy birthday, I hope you have a wonderful day!",
+};
+
+// Passes over the sample when measuring throughput, so batches fill up.
+constexpr size_t kRounds = 8;
+
+// How much slower than on the fastest pool a single sentence may be.
+constexpr double kSlack = 1.1;
+
+// Written above the section, and dropped along with it on the next run.
+constexpr const char *kMarker =
+    "# Measured by ibus-slimt-t8n --calibrate, read on startup.";
+
+struct Candidate {
+  size_t workers = 1;
+  size_t max_words = 0;
+  // Median, one sentence at a time.
+  Milliseconds latency{0};
+  // Sentences per second, many in flight.
+  double throughput = 0;
+};
+
+void measure(Candidate &candidate, WorkQueue::Workers workers,
+             const std::shared_ptr<Model> &model) {
+  workers.config.workers = candidate.workers;
+  workers.config.max_words = candidate.max_words;
+  // Every round would be served from slimt's cache otherwise.
+  workers.config.cache_size = 0;
+  WorkQueue queue(workers, WorkQueue::Limits{});
+
+  auto translate = [&queue, &model](const std::string &sentence) {
+    return queue.submit(Priority::Interactive,
+                        [model = model, sentence](Async &async) mutable {
+                          return async.translate(model, sentence, Options{});
+                        });
+  };
+
+  // Workers allocate on their first request, keep that out of the numbers.
+  translate(kSample.front()).wait();
+
+  std::vector<Milliseconds> latencies;
+  for (const std::string &sentence : kSample) {
+    auto start = Clock::now();
+    translate(sentence).wait();
+    latencies.emplace_back(Clock::now() - start);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  candidate.latency = latencies[latencies.size() / 2];
+
+  std::vector<std::shared_future<Response>> inflight;
+  auto start = Clock::now();
+  for (size_t round = 0; round < kRounds; round++) {
+    for (const std::string &sentence : kSample) {
+      inflight.push_back(translate(sentence));
+    }
+  }
+  for (const std::shared_future<Response> &response : inflight) {
+    response.wait();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  candidate.throughput = inflight.size() / elapsed.count();
+}
+
+std::vector<Candidate> candidates(const WorkQueue::Workers &workers) {
+  size_t cores = std::max<size_t>(1, std::thread::hardware_concurrency());
+  if (not workers.cpus.empty()) {
+    cores = workers.cpus.size();
+  }
+
+  std::vector<size_t> counts;
+  for (size_t count = 1; count < cores; count *= 2) {
+    counts.push_back(count);
+  }
+  counts.push_back(cores);
+
+  // Fewer workers first, see pick(...).
+  std::vector<Candidate> candidates;
+  for (size_t count : counts) {
+    for (size_t max_words : {256, 1024}) {
+      Candidate candidate;
+      candidate.workers = count;
+      candidate.max_words = max_words;
+      candidates.push_back(candidate);
+    }
+  }
+  return candidates;
+}
+
+const Candidate &pick(const std::vector<Candidate> &candidates) {
+  Milliseconds fastest = std::min_element(candidates.begin(), candidates.end(),
+                                          [](const auto &lhs, const auto &rhs) {
+                                            return lhs.latency < rhs.latency;
+                                          })
+                             ->latency;
+
+  const Candidate *best = nullptr;
+  for (const Candidate &candidate : candidates) {
+    if (candidate.latency > kSlack * fastest) {
+      continue;
+    }
+    // Later candidates take more resources, and have to be clearly better
+    // to be worth them.
+    if (not best or candidate.throughput > kSlack * best->throughput) {
+      best = &candidate;
+    }
+  }
+  return *best;
+}
+
+// Replaces the top-level service section of the config at path with service,
+// keeping everything else as written, comments included.
+bool write_back(const std::string &path, const YAML::Node &service) {
+  std::ifstream in(path);
+  if (not in) {
+    return false;
+  }
+
+  std::string kept;
+  bool skipping = false;
+  for (std::string line; std::getline(in, line);) {
+    if (line.rfind("service:", 0) == 0) {
+      skipping = true;
+      continue;
+    }
+    bool indented = not line.empty() and (line[0] == ' ' or line[0] == '\t');
+    if (skipping and indented) {
+      continue;
+    }
+    skipping = false;
+    if (line != kMarker) {
+      kept += line + "\n";
+    }
+  }
+
+  // One blank line before the section, however many runs came before.
+  while (kept.size() >= 2 and kept.compare(kept.size() - 2, 2, "\n\n") == 0) {
+    kept.pop_back();
+  }
+
+  YAML::Node root;
+  root["service"] = service;
+  YAML::Emitter emitter;
+  emitter << root;
+
+  // Replaced whole, so the config watcher never sees half a file.
+  std::string staging = path + ".calibrate";
+  {
+    std::ofstream out(staging);
+    out << kept << "\n" << kMarker << "\n" << emitter.c_str() << "\n";
+    if (not out) {
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(staging, path, error);
+  return not error;
+}
+
+} // namespace
+
+int calibrate(const std::string &config_path) {
+  Inventory inventory(config_path);
+  const Direction &direction = inventory.default_direction();
+  const std::string &tier = inventory.tiers().preview;
+  std::shared_ptr<Model> model = inventory.query(direction, tier);
+  if (not model) {
+    fprintf(stderr, "No model for %s -> %s to calibrate with\n",
+            direction.source.c_str(), direction.target.c_str());
+    return 1;
+  }
+
+  WorkQueue::Workers workers = ibus_slimt_t8n_workers(inventory.config());
+  printf("Calibrating with %s -> %s (%s)\n", direction.source.c_str(),
+         direction.target.c_str(), tier.c_str());
+  printf("%8s %10s %12s %14s\n", "workers", "max_words", "latency_ms",
+         "sentences/s");
+
+  std::vector<Candidate> measured = candidates(workers);
+  for (Candidate &candidate : measured) {
+    measure(candidate, workers, model);
+    printf("%8zu %10zu %12.2f %14.1f\n", candidate.workers,
+           candidate.max_words, candidate.latency.count(),
+           candidate.throughput);
+  }
+
+  const Candidate &best = pick(measured);
+  printf("Picked %zu workers, max_words %zu\n", best.workers, best.max_words);
+
+  // Settings the calibration does not cover are kept.
+  YAML::Node service = YAML::Clone(inventory.config()["service"]);
+  if (not service.IsMap()) {
+    service = YAML::Node(YAML::NodeType::Map);
+  }
+  service["workers"] = best.workers;
+  service["max_words"] = best.max_words;
+  if (not write_back(config_path, service)) {
+    fprintf(stderr, "Unable to write %s\n", config_path.c_str());
+    return 1;
+  }
+  printf("Written to %s, takes effect on restart\n", config_path.c_str());
+  return 0;
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,15 @@
+#pragma once
+#include <string>
+
+namespace ibus::slimt::t8n {
+
+// Times candidate worker pools on this machine, translating a sample with the
+// preview model of the default direction, and writes the best into the
+// service section of the config at config_path. The pool with the most
+// throughput wins among those that translate a single sentence about as fast
+// as the fastest one, fewer workers breaking ties, so the IME leaves cores
+// it cannot use to everything else. Results go to stdout. Returns an exit
+// status.
+int calibrate(const std::string &config_path);
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,161 @@
+#include "ibus-slimt-t8n/client.h"
+#include "ibus-slimt-t8n/logging.h"
+#include "ibus-slimt-t8n/protocol.h"
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+std::exception_ptr unreachable(const std::string &reason) {
+  return std::make_exception_ptr(
+      std::runtime_error("Translation server " + reason));
+}
+
+} // namespace
+
+Client::Client(std::string socket_path)
+    : socket_path_(std::move(socket_path)) {}
+
+Client::~Client() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ >= 0) {
+      // Wakes the reader, which closes the socket on its way out.
+      ::shutdown(fd_, SHUT_RDWR);
+    }
+  }
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+}
+
+bool Client::connect() {
+  if (fd_ >= 0) {
+    return true;
+  }
+
+  // The reader of the previous connection has already let go of it, and is
+  // at most on its way out.
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(address.sun_path)) {
+    LOG("Socket path too long: %s", socket_path_.c_str());
+    return false;
+  }
+  std::memcpy(address.sun_path, socket_path_.c_str(), socket_path_.size());
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  auto *generic = reinterpret_cast<sockaddr *>(&address); // NOLINT
+  if (::connect(fd, generic, sizeof(address)) < 0) {
+    ::close(fd);
+    return false;
+  }
+
+  LOG("Connected to translation server at %s", socket_path_.c_str());
+  fd_ = fd;
+  reader_ = std::thread([this, fd] { receive(fd); });
+  return true;
+}
+
+std::future<std::string> Client::translate(const std::string &source,
+                                           const std::string &target,
+                                           const std::string &tier,
+                                           std::string text,
+                                           Priority priority, Done done) {
+  std::promise<std::string> promise;
+  std::future<std::string> future = promise.get_future();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (not connect()) {
+    promise.set_exception(unreachable("not running at " + socket_path_));
+    return future;
+  }
+
+  protocol::Request request{
+      .id = next_id_++,       //
+      .source = source,       //
+      .target = target,       //
+      .tier = tier,           //
+      .priority = priority,   //
+      .text = std::move(text) //
+  };
+
+  // Written under the lock, so frames from different threads do not
+  // interleave.
+  if (not protocol::write_all(fd_, protocol::encode(request))) {
+    // The reader sees the connection drop and fails everything else.
+    ::shutdown(fd_, SHUT_RDWR);
+    promise.set_exception(unreachable("went away"));
+    return future;
+  }
+
+  Request pending{
+      .promise = std::move(promise), //
+      .done = std::move(done)        //
+  };
+  inflight_.emplace(request.id, std::move(pending));
+  return future;
+}
+
+void Client::receive(int fd) {
+  std::string frame;
+  protocol::Reply reply;
+  while (protocol::read_frame(fd, frame) and protocol::decode(frame, reply)) {
+    Done done;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto query = inflight_.find(reply.id);
+      if (query == inflight_.end()) {
+        continue;
+      }
+
+      std::promise<std::string> &promise = query->second.promise;
+      if (reply.kind == protocol::Kind::Ok) {
+        promise.set_value(std::move(reply.text));
+      } else {
+        promise.set_exception(
+            std::make_exception_ptr(std::runtime_error(reply.text)));
+      }
+      done = std::move(query->second.done);
+      inflight_.erase(query);
+    }
+    // Without mutex_, which done has no business with.
+    if (done) {
+      done();
+    }
+  }
+
+  std::vector<Done> dones;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LOG("Lost translation server, failing %zu requests", inflight_.size());
+    for (auto &[id, request] : inflight_) {
+      request.promise.set_exception(unreachable("went away"));
+      if (request.done) {
+        dones.push_back(std::move(request.done));
+      }
+    }
+    inflight_.clear();
+    ::close(fd);
+    fd_ = -1;
+  }
+  for (Done &done : dones) {
+    done();
+  }
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,61 @@
+#pragma once
+#include "ibus-slimt-t8n/priority.h"
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace ibus::slimt::t8n {
+
+// Talks to a translation server (see Server) over its Unix socket. Requests
+// are pipelined on a single connection: translate(...) writes the request and
+// returns, a reader thread fulfils futures as replies come in.
+//
+// Connects on first use, and again on the next request after the server goes
+// away. Requests in flight when that happens fail with an exception, as does
+// every request while the server is down.
+class Client {
+public:
+  explicit Client(std::string socket_path);
+  ~Client();
+
+  Client(const Client &) = delete;
+  Client &operator=(const Client &) = delete;
+
+  // Called on the reader thread once the future translate(...) returned is
+  // ready, unless it already was on return.
+  using Done = std::function<void()>;
+
+  // tier is empty for the preview tier of the server, which schedules the
+  // request at priority.
+  std::future<std::string> translate(const std::string &source,
+                                     const std::string &target,
+                                     const std::string &tier, std::string text,
+                                     Priority priority, Done done = nullptr);
+
+private:
+  // Connects if not connected, with mutex_ held. False if the server is not
+  // reachable.
+  bool connect();
+
+  // Reads replies off fd until it closes, then fails everything in flight.
+  void receive(int fd);
+
+  struct Request {
+    std::promise<std::string> promise;
+    Done done;
+  };
+
+  std::string socket_path_;
+
+  std::mutex mutex_;
+  int fd_ = -1;
+  uint32_t next_id_ = 0;
+  std::unordered_map<uint32_t, Request> inflight_;
+  std::thread reader_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -189,7 +189,18 @@ FUNCTION(cursor_up, cursor_up)
 FUNCTION(cursor_down, cursor_down)
 #undef FUNCTION
 
-Engine::Engine(IBusEngine *engine) : engine_holder_(engine), engine_(engine) {
+Engine::Engine(IBusEngine *engine)
+    : engine_holder_(engine), engine_(engine),
+      backend_(std::make_unique<CoalescingBackend>(
+          std::make_unique<IBusBackend>(engine))) {
+#if IBUS_CHECK_VERSION(1, 5, 4)
+  m_input_purpose_ = IBUS_INPUT_PURPOSE_FREE_FORM;
+#endif
+}
+
+Engine::Engine(std::unique_ptr<Backend> backend)
+    : engine_(nullptr),
+      backend_(std::make_unique<CoalescingBackend>(std::move(backend))) {
 #if IBUS_CHECK_VERSION(1, 5, 4)
   m_input_purpose_ = IBUS_INPUT_PURPOSE_FREE_FORM;
 #endif
@@ -204,6 +215,7 @@ gboolean Engine::content_is_password() {
 }
 
 void Engine::focus_out() {
+  backend_->forget();
 #if IBUS_CHECK_VERSION(1, 5, 4)
   m_input_purpose_ = IBUS_INPUT_PURPOSE_FREE_FORM;
 #endif
@@ -1,7 +1,9 @@
 #pragma once
 #include <ibus.h>
 
-#include "gtypes.h"
+#include "ibus-slimt-t8n/backend.h"
+#include "ibus-slimt-t8n/gtypes.h"
+#include <memory>
 
 namespace ibus::slimt::t8n {
 
@@ -12,6 +14,12 @@ GType ibus_slimt_t8n_engine_get_type();
 class Engine {
 public:
   explicit Engine(IBusEngine *engine);
+
+  // Without an IBusEngine, for driving the engine in-process.
+  explicit Engine(std::unique_ptr<Backend> backend);
+
+  // Of the output to the backend, see CoalescingBackend.
+  const CoalescingBackend::Stats &output() const { return backend_->stats(); }
   virtual ~Engine() = default;
 
   gboolean content_is_password();
@@ -36,55 +44,56 @@ public:
   virtual void candidate_clicked(guint index, guint button, guint state) = 0;
 
 protected:
-  void commit_text(const g::Text &text) const {
-    ibus_engine_commit_text(engine_, text.get());
-  }
+  void commit_text(const g::Text &text) const { backend_->commit_text(text); }
 
   void update_preedit_text(const g::Text &text, guint cursor,
                            gboolean visible) const {
-    ibus_engine_update_preedit_text(engine_, text.get(), cursor, visible);
+    backend_->update_preedit_text(text, cursor, visible);
   }
 
-  void show_preedit_text() const { ibus_engine_show_preedit_text(engine_); }
+  void show_preedit_text() const { backend_->show_preedit_text(); }
 
-  void hide_preedit_text() const { ibus_engine_hide_preedit_text(engine_); }
+  void hide_preedit_text() const { backend_->hide_preedit_text(); }
 
   void update_auxiliary_text(const g::Text &text, gboolean visible) const {
-    ibus_engine_update_auxiliary_text(engine_, text.get(), visible);
+    backend_->update_auxiliary_text(text, visible);
   }
 
-  void show_auxiliary_text() const { ibus_engine_show_auxiliary_text(engine_); }
+  void show_auxiliary_text() const { backend_->show_auxiliary_text(); }
 
-  void hide_auxiliary_text() const { ibus_engine_hide_auxiliary_text(engine_); }
+  void hide_auxiliary_text() const { backend_->hide_auxiliary_text(); }
 
   void update_lookup_table(const g::LookupTable &table,
                            gboolean visible) const {
-    ibus_engine_update_lookup_table(engine_, table.get(), visible);
+    backend_->update_lookup_table(table, visible);
   }
 
   void update_lookup_table_fast(const g::LookupTable &table,
                                 gboolean visible) const {
-    ibus_engine_update_lookup_table_fast(engine_, table.get(), visible);
+    backend_->update_lookup_table_fast(table, visible);
   }
 
-  void show_lookup_table() const { ibus_engine_show_lookup_table(engine_); }
+  void show_lookup_table() const { backend_->show_lookup_table(); }
 
-  void hide_lookup_table() const { ibus_engine_hide_lookup_table(engine_); }
+  void hide_lookup_table() const { backend_->hide_lookup_table(); }
 
   static void clear_lookup_table(const g::LookupTable &table) {
     ibus_lookup_table_clear(table.get());
   }
 
   void register_properties(const g::PropList &props) const {
-    ibus_engine_register_properties(engine_, props.get());
+    backend_->register_properties(props);
   }
 
   void update_property(const g::Property &prop) const {
-    ibus_engine_update_property(engine_, prop.get());
+    backend_->update_property(prop);
   }
 
   g::Holder<IBusEngine> engine_holder_; // engine pointer
   IBusEngine *engine_;
+  // Whatever the engine sends out goes through here, so only what changes on
+  // screen reaches the backend.
+  std::unique_ptr<CoalescingBackend> backend_;
 
 #if IBUS_CHECK_VERSION(1, 5, 4)
   IBusInputPurpose m_input_purpose_;
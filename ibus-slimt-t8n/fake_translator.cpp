@@ -0,0 +1,302 @@
+#include "ibus-slimt-t8n/fake_translator.h"
+#include "yaml-cpp/yaml.h"
+#include <algorithm>
+#include <cctype>
+#include <random>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+// Runs of non-space, without copying them out.
+size_t count_tokens(std::string_view text) {
+  size_t count = 0;
+  bool inside = false;
+  for (char c : text) {
+    bool space = isspace(static_cast<unsigned char>(c)) != 0;
+    count += (not space and not inside) ? 1 : 0;
+    inside = not space;
+  }
+  return count;
+}
+
+// Optional section, for FakeTranslator only, e.g.
+//
+//   fake:
+//     base: 5 # ms per sentence
+//     per_token: 1.5 # ms per token
+//     jitter: 0.2 # fraction either way
+//     pivot: 2 # cost multiplier when neither side is English
+//     workers: 2 # simulated workers, 0 for no contention
+//     seed: 0
+FakeTranslator::Cost fake_cost(const std::string &path) {
+  FakeTranslator::Cost cost;
+  YAML::Node fake;
+  try {
+    fake = YAML::LoadFile(path)["fake"];
+  } catch (const YAML::Exception &) {
+    // No config is fine, the fake needs nothing from it.
+  }
+  if (not fake) {
+    return cost;
+  }
+
+  auto microseconds = [&fake](const char *key,
+                              std::chrono::microseconds fallback) {
+    double milliseconds = fake[key].as<double>(fallback.count() / 1000.0);
+    return std::chrono::microseconds(
+        static_cast<int64_t>(std::max(0.0, milliseconds) * 1000));
+  };
+  cost.base = microseconds("base", cost.base);
+  cost.per_token = microseconds("per_token", cost.per_token);
+  cost.jitter = std::clamp(fake["jitter"].as<double>(cost.jitter), 0.0, 1.0);
+  cost.pivot = std::max(0.0, fake["pivot"].as<double>(cost.pivot));
+  cost.workers = fake["workers"].as<size_t>(cost.workers);
+  cost.seed = fake["seed"].as<uint64_t>(cost.seed);
+  return cost;
+}
+
+} // namespace
+
+FakeTranslator::FakeTranslator(const std::string &ibus_config_path)
+    : FakeTranslator(fake_cost(ibus_config_path)) {}
+
+FakeTranslator::FakeTranslator(Cost cost)
+    : cost_(cost), free_at_(cost.workers),
+      dispatcher_([this] { dispatch(); }) {}
+
+FakeTranslator::~FakeTranslator() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+    pending_.reset();
+  }
+  work_.notify_all();
+  dispatcher_.join();
+}
+
+void FakeTranslator::set_direction(const Direction &direction) {
+  direction_ = direction;
+}
+
+void FakeTranslator::set_verify(bool verify) { verify_ = verify; }
+
+std::string FakeTranslator::render(std::string_view input) {
+  size_t count = count_tokens(input);
+
+  // For a given count, generates that many tokens of 6 hex digits. The entire
+  // string changes with the count, which simulates translation in some
+  // capacity.
+  constexpr size_t kTokenLength = 6;
+  constexpr char kDigits[] = "0123456789abcdef";
+  std::mt19937_64 generator(count);
+  std::string target;
+  target.reserve(count * (kTokenLength + 1));
+  for (size_t i = 0; i < count; i++) {
+    if (i != 0) {
+      target.push_back(' ');
+    }
+    auto value = static_cast<uint32_t>(generator());
+    for (size_t digit = kTokenLength; digit-- > 0;) {
+      target.push_back(kDigits[(value >> (4 * digit)) & 0xf]);
+    }
+  }
+  return target;
+}
+
+FakeTranslator::Clock::duration
+FakeTranslator::cost(const Direction &direction,
+                     std::string_view sentence) const {
+  size_t tokens = count_tokens(sentence);
+  double cost = static_cast<double>(cost_.base.count()) +
+                static_cast<double>(cost_.per_token.count() * tokens);
+
+  if (cost_.jitter > 0) {
+    // Seeded by the sentence, so it costs the same every time.
+    std::mt19937_64 generator(cost_.seed ^
+                              std::hash<std::string_view>()(sentence));
+    // Uniform in [-1, 1).
+    double unit = static_cast<double>(generator() >> 11) * 0x1.0p-52 - 1;
+    cost *= 1 + cost_.jitter * unit;
+  }
+
+  if (direction.source != "English" and direction.target != "English") {
+    cost *= cost_.pivot;
+  }
+
+  return std::chrono::microseconds(static_cast<int64_t>(cost));
+}
+
+FakeTranslator::Clock::time_point
+FakeTranslator::schedule(const Direction &direction,
+                         const std::string &source) {
+  auto now = Clock::now();
+  auto done = now;
+  std::lock_guard<std::mutex> lock(workers_mutex_);
+  for (const Segment &sentence : segment(source)) {
+    Clock::duration cost = this->cost(direction, sentence.text);
+    if (free_at_.empty()) {
+      done = std::max(done, now + cost);
+      continue;
+    }
+    // To whichever worker frees up first, in order of arrival.
+    auto worker = std::min_element(free_at_.begin(), free_at_.end());
+    *worker = std::max(*worker, now) + cost;
+    done = std::max(done, *worker);
+  }
+  return done;
+}
+
+bool FakeTranslator::wait_until(Clock::time_point then) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_.wait_until(lock, then, [this] { return shutdown_; });
+  return not shutdown_;
+}
+
+std::string FakeTranslator::translate(std::string input) { // NOLINT
+  std::this_thread::sleep_until(schedule(direction_, input));
+  return render(input);
+}
+
+std::string FakeTranslator::backtranslate(std::string input) {
+  std::this_thread::sleep_until(schedule(reverse(direction_), input));
+  return render(input);
+}
+
+void FakeTranslator::translate(std::string source, Callback callback,
+                               std::optional<Range> /*dirty*/) {
+  Job job{
+      .source = std::move(source),    //
+      .direction = direction_,        //
+      .verify = verify_,              //
+      .callback = std::move(callback) //
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.submitted;
+    if (pending_) {
+      ++stats_.coalesced;
+    }
+    pending_ = std::move(job);
+    superseded_ = running_;
+  }
+  work_.notify_one();
+}
+
+void FakeTranslator::cancel() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pending_) {
+    ++stats_.coalesced;
+    pending_.reset();
+  }
+  superseded_ = running_;
+}
+
+std::future<std::string> FakeTranslator::submit(const Direction &direction,
+                                                std::string input,
+                                                const std::string & /*tier*/,
+                                                Priority /*priority*/) {
+  // Queued on the simulated workers right away, so requests in flight
+  // together contend the way they would for the real ones.
+  Clock::time_point done = schedule(direction, input);
+  return std::async(std::launch::deferred,
+                    [done, input = std::move(input)] {
+                      std::this_thread::sleep_until(done);
+                      return render(input);
+                    });
+}
+
+FakeTranslator::Stats FakeTranslator::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+FakeTranslator::Latency
+FakeTranslator::latency(const Direction &direction) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = latencies_.find({direction.source, direction.target});
+  return found != latencies_.end() ? found->second : Latency{};
+}
+
+void FakeTranslator::measure(const Direction &direction, bool backward,
+                             Milliseconds elapsed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Latency &latency = latencies_[{direction.source, direction.target}];
+  std::optional<Milliseconds> &average =
+      backward ? latency.backward : latency.forward;
+  if (average) {
+    *average = Translator::kSmoothing * elapsed +
+               (1 - Translator::kSmoothing) * *average;
+  } else {
+    average = elapsed;
+  }
+  if (not backward) {
+    latency.pivot =
+        direction.source != "English" and direction.target != "English";
+  }
+}
+
+bool FakeTranslator::superseded() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return superseded_ or shutdown_;
+}
+
+void FakeTranslator::dispatch() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      running_ = false;
+      work_.wait(lock, [this] { return shutdown_ or pending_.has_value(); });
+      if (shutdown_) {
+        return;
+      }
+      job = std::move(*pending_);
+      pending_.reset();
+      running_ = true;
+      superseded_ = false;
+      stats_.sentences += segment(job.source).size();
+    }
+
+    // Like the real thing, a newer request only cuts this one short between
+    // steps.
+    Translation translation;
+    auto start = Clock::now();
+    if (not wait_until(schedule(job.direction, job.source))) {
+      return;
+    }
+    translation.target = render(job.source);
+    measure(job.direction, /*backward=*/false, Clock::now() - start);
+
+    if (job.verify and not superseded()) {
+      Direction backward = reverse(job.direction);
+      start = Clock::now();
+      if (not wait_until(schedule(backward, translation.target))) {
+        return;
+      }
+      translation.backtranslation = render(translation.target);
+      measure(job.direction, /*backward=*/true, Clock::now() - start);
+    }
+
+    if (superseded()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.cancelled;
+      continue;
+    }
+
+    translation.source = std::move(job.source);
+    job.callback(std::move(translation));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.completed;
+  }
+}
+
+const Languages &FakeTranslator::languages() const { return languages_; }
+
+const Direction &FakeTranslator::default_direction() const {
+  return direction_;
+}
+
+} // namespace ibus::slimt::t8n
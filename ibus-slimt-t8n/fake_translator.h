@@ -0,0 +1,156 @@
+#pragma once
+#include "ibus-slimt-t8n/power.h"
+#include "ibus-slimt-t8n/priority.h"
+#include "ibus-slimt-t8n/translator.h"
+#include "ibus-slimt-t8n/work_queue.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Stands in for Translator without any models: each source token becomes a
+// made-up one, and every sentence takes as long as Cost says, so the engine
+// and its scheduling can run, and be timed, on machines without models. The
+// same input gets the same translation and the same cost every time, jitter
+// included.
+class FakeTranslator {
+public:
+  using Stats = Translator::Stats;
+  using Milliseconds = Translator::Milliseconds;
+  using Latency = Translator::Latency;
+
+  // What a sentence costs: base plus per_token for each of its tokens, scaled
+  // by up to jitter either way and by pivot when neither side is English.
+  // Unless workers is 0, sentences queue for that many simulated workers, the
+  // way they contend for the real pool.
+  struct Cost {
+    std::chrono::microseconds base{0};
+    std::chrono::microseconds per_token{0};
+    double jitter = 0;
+    double pivot = 2;
+    size_t workers = 0;
+    uint64_t seed = 0;
+  };
+
+  // Cost from the fake section of the config, free if there is none.
+  explicit FakeTranslator(const std::string &ibus_config_path);
+  explicit FakeTranslator(Cost cost);
+  ~FakeTranslator();
+
+  void set_direction(const Direction &direction);
+  void set_verify(bool verify);
+
+  bool verify() const { return verify_; }
+  bool verifiable() const { return true; }
+  const Direction &direction() const { return direction_; }
+
+  std::string translate(std::string input);
+  std::string backtranslate(std::string input);
+  bool loading() const { return false; }
+
+  // Same contract as their Translator counterparts. Nothing is memoized, so
+  // every request pays in full.
+  void translate(std::string source, Callback callback,
+                 std::optional<Range> dirty = std::nullopt);
+  void cancel();
+  std::future<std::string> submit(const Direction &direction,
+                                  std::string input,
+                                  const std::string &tier = "",
+                                  Priority priority = Priority::Background);
+
+  // There is nothing to guess ahead with or refine to.
+  void speculate(std::string /*source*/) {}
+  void drop_speculation() {}
+  std::optional<std::string> refine(const std::string & /*source*/) {
+    return std::nullopt;
+  }
+
+  Stats stats() const;
+  std::array<WorkQueue::Stats, kPriorities> queues() const { return {}; }
+  Latency latency(const Direction &direction) const;
+  Inventory::Refresh refresh() const { return {}; }
+  std::shared_ptr<const PowerProfile> power() const { return power_; }
+
+  const Direction &default_direction() const;
+  const Languages &languages() const;
+
+  // The fake config never changes.
+  void on_reload(std::function<void()> /*callback*/) {}
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Job {
+    std::string source;
+    Direction direction;
+    bool verify = false;
+    Callback callback;
+  };
+
+  // Made-up translation of input, one token per token.
+  static std::string render(std::string_view input);
+
+  // What a sentence of source costs in direction.
+  Clock::duration cost(const Direction &direction,
+                       std::string_view sentence) const;
+
+  // Lines the sentences of source up on the simulated workers and returns
+  // when the last one is done.
+  Clock::time_point schedule(const Direction &direction,
+                             const std::string &source);
+
+  // Sleeps until then, or returns false early on shutdown.
+  bool wait_until(Clock::time_point then);
+
+  void dispatch();
+  bool superseded() const;
+  void measure(const Direction &direction, bool backward,
+               Milliseconds elapsed);
+
+  Cost cost_;
+
+  Languages languages_ = {
+      {"English", "German", "French"}, //
+      {"English", "German", "French"}  //
+  };
+
+  Direction direction_{
+      .source = "English", //
+      .target = "German"   //
+  };
+
+  bool verify_ = false;
+  std::shared_ptr<const PowerProfile> power_ =
+      std::make_shared<const PowerProfile>();
+
+  // When each simulated worker is next free.
+  std::mutex workers_mutex_;
+  std::vector<Clock::time_point> free_at_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_;
+  std::optional<Job> pending_;
+  bool running_ = false;
+  bool superseded_ = false;
+  bool shutdown_ = false;
+  Stats stats_;
+  std::map<std::pair<std::string, std::string>, Latency> latencies_;
+
+  // Declared last, see Translator::dispatcher_.
+  std::thread dispatcher_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,147 @@
+#include "ibus-slimt-t8n/gap_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+bool is_continuation(char c) {
+  return (static_cast<unsigned char>(c) & 0xC0) == 0x80; // NOLINT
+}
+
+} // namespace
+
+void GapBuffer::reserve(size_t bytes) {
+  if (gap() >= bytes) {
+    return;
+  }
+
+  // Grow geometrically, so typing at the cursor is amortized constant time.
+  constexpr size_t kMinimum = 64;
+  size_t after = data_.size() - gap_end_;
+  size_t capacity = std::max({kMinimum, 2 * data_.size(), size() + bytes});
+  std::vector<char> data(capacity);
+  std::copy(data_.begin(), data_.begin() + gap_begin_, data.begin());
+  std::copy(data_.end() - after, data_.end(), data.end() - after);
+  data_ = std::move(data);
+  gap_end_ = data_.size() - after;
+}
+
+void GapBuffer::move_gap(size_t position) {
+  position = std::min(position, size());
+  if (position < gap_begin_) {
+    size_t count = gap_begin_ - position;
+    std::memmove(&data_[gap_end_ - count], &data_[position], count);
+    gap_begin_ -= count;
+    gap_end_ -= count;
+  } else if (position > gap_begin_) {
+    size_t count = position - gap_begin_;
+    std::memmove(&data_[gap_begin_], &data_[gap_end_], count);
+    gap_begin_ += count;
+    gap_end_ += count;
+  }
+}
+
+void GapBuffer::mark(size_t begin, size_t removed, size_t inserted) {
+  Range edit{.begin = begin, .end = begin + inserted};
+  if (!dirty_) {
+    dirty_ = edit;
+    return;
+  }
+
+  // Positions after the edit move with it, those inside it collapse onto it.
+  auto shift = [&](size_t position) {
+    if (position >= begin + removed) {
+      return position - removed + inserted;
+    }
+    return std::min(position, edit.end);
+  };
+
+  dirty_ = Range{
+      .begin = std::min(shift(dirty_->begin), edit.begin), //
+      .end = std::max(shift(dirty_->end), edit.end)        //
+  };
+}
+
+void GapBuffer::insert(std::string_view text) {
+  if (text.empty()) {
+    return;
+  }
+  reserve(text.size());
+  std::copy(text.begin(), text.end(), data_.begin() + gap_begin_);
+  mark(gap_begin_, 0, text.size());
+  gap_begin_ += text.size();
+}
+
+bool GapBuffer::erase_before() {
+  if (gap_begin_ == 0) {
+    return false;
+  }
+  size_t begin = gap_begin_ - 1;
+  while (begin > 0 and is_continuation(data_[begin])) {
+    --begin;
+  }
+  mark(begin, gap_begin_ - begin, 0);
+  gap_begin_ = begin;
+  return true;
+}
+
+bool GapBuffer::erase_after() {
+  if (gap_end_ == data_.size()) {
+    return false;
+  }
+  size_t end = gap_end_ + 1;
+  while (end < data_.size() and is_continuation(data_[end])) {
+    ++end;
+  }
+  mark(gap_begin_, end - gap_end_, 0);
+  gap_end_ = end;
+  return true;
+}
+
+bool GapBuffer::left() {
+  if (gap_begin_ == 0) {
+    return false;
+  }
+  size_t position = gap_begin_ - 1;
+  while (position > 0 and is_continuation(data_[position])) {
+    --position;
+  }
+  move_gap(position);
+  return true;
+}
+
+bool GapBuffer::right() {
+  if (gap_end_ == data_.size()) {
+    return false;
+  }
+  size_t position = gap_end_ + 1;
+  while (position < data_.size() and is_continuation(data_[position])) {
+    ++position;
+  }
+  move_gap(gap_begin_ + (position - gap_end_));
+  return true;
+}
+
+std::string GapBuffer::text() const {
+  std::string text;
+  this->text(text);
+  return text;
+}
+
+void GapBuffer::text(std::string &out) const {
+  out.clear();
+  out.reserve(size());
+  out.append(data_.data(), gap_begin_);
+  out.append(data_.data() + gap_end_, data_.size() - gap_end_);
+}
+
+void GapBuffer::clear() {
+  // Keeps the allocation around for the next sentence.
+  gap_begin_ = 0;
+  gap_end_ = data_.size();
+  dirty_.reset();
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,69 @@
+#pragma once
+#include "ibus-slimt-t8n/segmenter.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Text being edited at a cursor. Insertions and deletions at the cursor are
+// cheap wherever it is, since the free space (the gap) sits at the cursor and
+// only moves with it.
+//
+// Cursor movement and deletion step over whole UTF-8 code points. Positions
+// are byte offsets into text().
+//
+// Also tracks which bytes edits have touched since the last clean(), so a
+// consumer can tell which parts of the text are unchanged since it last
+// looked.
+class GapBuffer {
+public:
+  void insert(std::string_view text);
+
+  // Backspace and Delete. Both return false if there is nothing to delete.
+  bool erase_before();
+  bool erase_after();
+
+  // Return false if already at the start, or the end.
+  bool left();
+  bool right();
+
+  void home() { move_gap(0); }
+  void end() { move_gap(size()); }
+
+  size_t cursor() const { return gap_begin_; }
+  size_t size() const { return data_.size() - gap(); }
+  bool empty() const { return size() == 0; }
+
+  // Byte before the cursor, '\0' at the start.
+  char before() const { return gap_begin_ > 0 ? data_[gap_begin_ - 1] : '\0'; }
+
+  std::string text() const;
+
+  // Same, into out, which only allocates if out is too small to hold it.
+  void text(std::string &out) const;
+  void clear();
+
+  // Smallest range covering every edit since the last clean(), in the
+  // coordinates of text() now. Unset if nothing has changed.
+  const std::optional<Range> &dirty() const { return dirty_; }
+  void clean() { dirty_.reset(); }
+
+private:
+  size_t gap() const { return gap_end_ - gap_begin_; }
+  void move_gap(size_t position);
+  void reserve(size_t bytes);
+
+  // Extends dirty_ to cover [begin, end) after the text in between changed
+  // from removed bytes to inserted ones.
+  void mark(size_t begin, size_t removed, size_t inserted);
+
+  std::vector<char> data_;
+  size_t gap_begin_ = 0;
+  size_t gap_end_ = 0;
+  std::optional<Range> dirty_;
+};
+
+} // namespace ibus::slimt::t8n
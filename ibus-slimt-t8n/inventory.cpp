@@ -0,0 +1,333 @@
+#include "ibus-slimt-t8n/inventory.h"
+#include "ibus-slimt-t8n/persistent_cache.h"
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+
+namespace ibus::slimt::t8n {
+
+Direction reverse(const Direction &direction) {
+  return {
+      .source = direction.target, //
+      .target = direction.source  //
+  };
+}
+
+namespace {
+
+// Tiers from fastest to slowest, for when the one asked for is missing.
+int rank(const std::string &tier) {
+  static const std::vector<std::string> kOrder = {"nano", "tiny", "base"};
+  auto position = std::find(kOrder.begin(), kOrder.end(), tier);
+  return static_cast<int>(position - kOrder.begin());
+}
+
+ModelSpec resolve(const YAML::Node &config) {
+  auto root = config["root"].as<std::string>();
+  auto prefix_root = [&root](const std::string &path) {
+    return root + "/" + path;
+  };
+
+  Package<std::string> path{
+      .model = prefix_root(config["model"].as<std::string>()), //
+      .vocabulary =
+          prefix_root(config["vocabs"]["source"].as<std::string>()),  //
+      .shortlist = prefix_root(config["shortlist"].as<std::string>()) //
+  };
+
+  return ModelSpec{
+      .path = std::move(path),                        //
+      .arch = config["arch"].as<std::string>("tiny"), //
+  };
+}
+
+uint64_t fingerprint(const YAML::Node &config) {
+  namespace fs = std::filesystem;
+  ModelSpec spec = resolve(config);
+  std::error_code ec;
+  auto size = fs::file_size(spec.path.model, ec);
+  auto mtime = fs::last_write_time(spec.path.model, ec);
+
+  std::string fingerprint = spec.path.model + '\0' + spec.arch + '\0' +
+                            std::to_string(size) + '\0' +
+                            std::to_string(mtime.time_since_epoch().count());
+  return fnv1a(fingerprint);
+}
+
+} // namespace
+
+Inventory::Inventory(const std::string &config_path) {
+  inventory_ = load(config_path);
+  using Strings = std::vector<std::string>;
+  auto select_languages = inventory_["languages"].as<Strings>();
+  select_languages_.insert(select_languages.begin(), select_languages.end());
+
+  YAML::Node models = inventory_["models"];
+  for (const YAML::Node &model : models) {
+    // std::string type = entry["type"].GetString();
+    YAML::Node node = model["direction"];
+
+    Direction direction{
+        .source = node["source"].as<std::string>(), //
+        .target = node["target"].as<std::string>()  //
+    };
+
+    auto preferred = [&, this](const std::string &lang) {
+      return select_languages_.find(lang) != select_languages_.end();
+    };
+
+    if (preferred(direction.source) and preferred(direction.target)) {
+      languages_.source.insert(direction.source);
+      languages_.target.insert(direction.target);
+    }
+
+    auto tier = model["arch"].as<std::string>("tiny");
+    directions_[direction][tier] = model;
+  }
+
+  default_direction_ = {
+      .source = inventory_["default"]["source"].as<std::string>(), //
+      .target = inventory_["default"]["target"].as<std::string>()  //
+  };
+
+  verify_ = inventory_["verify"].as<bool>();
+
+  // Optional, translates likely next keystrokes while the user pauses.
+  speculate_ = inventory_["speculate"].as<bool>(speculate_);
+
+  // Optional section, e.g.
+  //
+  //   tiers:
+  //     preview: tiny
+  //     commit: base
+  //     budget: 150 # ms
+  if (YAML::Node tiers = inventory_["tiers"]) {
+    tiers_.preview = tiers["preview"].as<std::string>(tiers_.preview);
+    tiers_.commit = tiers["commit"].as<std::string>(tiers_.commit);
+    tiers_.budget = std::chrono::milliseconds(
+        tiers["budget"].as<int64_t>(tiers_.budget.count()));
+  }
+
+  // Optional section, e.g.
+  //
+  //   refresh:
+  //     target: 100 # ms
+  //     policy: adaptive # or every, debounced, boundary
+  if (YAML::Node refresh = inventory_["refresh"]) {
+    refresh_.target = std::chrono::milliseconds(
+        refresh["target"].as<int64_t>(refresh_.target.count()));
+    refresh_.policy = refresh["policy"].as<std::string>(refresh_.policy);
+  }
+
+  // Optional section, e.g.
+  //
+  //   loading:
+  //     mmap: true
+  //     prefetch: true
+  if (YAML::Node loading = inventory_["loading"]) {
+    mmap_ = loading["mmap"].as<bool>(mmap_);
+    prefetch_ = loading["prefetch"].as<bool>(prefetch_);
+  }
+}
+
+const YAML::Node *Inventory::find(const Direction &direction,
+                                  const std::string &tier) const {
+  auto query = directions_.find(direction);
+  if (query == directions_.end()) {
+    return nullptr;
+  }
+
+  const Tiered &tiered = query->second;
+  auto exact = tiered.find(tier);
+  if (exact != tiered.end()) {
+    return &exact->second;
+  }
+
+  auto fastest = std::min_element(
+      tiered.begin(), tiered.end(), [](const auto &lhs, const auto &rhs) {
+        return rank(lhs.first) < rank(rhs.first);
+      });
+  return &fastest->second;
+}
+
+std::shared_ptr<Model> Inventory::query(const Direction &direction,
+                                        const std::string &tier) const {
+  const YAML::Node *config = find(direction, tier);
+  if (config) {
+    return model_cache().get(spec(*config));
+  }
+  return nullptr;
+}
+
+ModelSpec Inventory::spec(const YAML::Node &config) const {
+  ModelSpec spec = resolve(config);
+  spec.mmap = mmap_;
+  spec.prefetch = prefetch_;
+  return spec;
+}
+
+std::vector<ModelSpec> Inventory::specs() const {
+  std::vector<ModelSpec> specs;
+  for (const auto &[direction, tiered] : directions_) {
+    for (const auto &[tier, config] : tiered) {
+      specs.push_back(spec(config));
+    }
+  }
+  return specs;
+}
+
+bool Inventory::Diff::empty() const {
+  return added.empty() and removed.empty() and changed.empty() and
+         not languages and not default_direction and not verify and
+         not speculate and not tiers and not refresh;
+}
+
+Inventory::Diff Inventory::diff(const Inventory &before,
+                                const Inventory &after) {
+  auto name = [](const Direction &direction, const std::string &tier) {
+    return direction.source + " -> " + direction.target + " (" + tier + ")";
+  };
+
+  // Looks up the entry for direction at tier, without falling back.
+  auto entry = [](const Inventory &inventory, const Direction &direction,
+                  const std::string &tier) -> const YAML::Node * {
+    auto query = inventory.directions_.find(direction);
+    if (query == inventory.directions_.end()) {
+      return nullptr;
+    }
+    auto exact = query->second.find(tier);
+    return exact != query->second.end() ? &exact->second : nullptr;
+  };
+
+  Diff diff;
+  for (const auto &[direction, tiered] : after.directions_) {
+    for (const auto &[tier, config] : tiered) {
+      const YAML::Node *previous = entry(before, direction, tier);
+      if (!previous) {
+        diff.added.push_back(name(direction, tier));
+      } else if (YAML::Dump(*previous) != YAML::Dump(config) or
+                 fingerprint(*previous) != fingerprint(config)) {
+        diff.changed.push_back(name(direction, tier));
+      }
+    }
+  }
+
+  for (const auto &[direction, tiered] : before.directions_) {
+    for (const auto &[tier, config] : tiered) {
+      if (!entry(after, direction, tier)) {
+        diff.removed.push_back(name(direction, tier));
+      }
+    }
+  }
+
+  diff.languages = before.select_languages_ != after.select_languages_ or
+                   before.languages_.source != after.languages_.source or
+                   before.languages_.target != after.languages_.target;
+  diff.default_direction =
+      before.default_direction_.source != after.default_direction_.source or
+      before.default_direction_.target != after.default_direction_.target;
+  diff.verify = before.verify_ != after.verify_;
+  diff.speculate = before.speculate_ != after.speculate_;
+  diff.tiers = before.tiers_.preview != after.tiers_.preview or
+               before.tiers_.commit != after.tiers_.commit or
+               before.tiers_.budget != after.tiers_.budget;
+  diff.refresh = before.refresh_.target != after.refresh_.target or
+                 before.refresh_.policy != after.refresh_.policy;
+  return diff;
+}
+
+uint64_t Inventory::identity(const Direction &direction,
+                             const std::string &tier) const {
+  const YAML::Node *config = find(direction, tier);
+  return config ? fingerprint(*config) : 0;
+}
+
+uint64_t Inventory::identity(uint64_t first, uint64_t second) {
+  return fnv1a(std::to_string(second), first);
+}
+
+std::unordered_set<uint64_t> Inventory::identities() const {
+  std::unordered_set<uint64_t> identities;
+  std::vector<uint64_t> to_en;
+  std::vector<uint64_t> from_en;
+  for (const auto &[direction, tiered] : directions_) {
+    for (const auto &[tier, config] : tiered) {
+      uint64_t single = fingerprint(config);
+      identities.insert(single);
+      if (direction.target == "English") {
+        to_en.push_back(single);
+      }
+      if (direction.source == "English") {
+        from_en.push_back(single);
+      }
+    }
+  }
+
+  for (uint64_t first : to_en) {
+    for (uint64_t second : from_en) {
+      identities.insert(identity(first, second));
+    }
+  }
+  return identities;
+}
+
+const Languages &Inventory::languages() const { return languages_; }
+
+bool Inventory::exists(const Direction &direction) const {
+  auto query = directions_.find(direction);
+  return query != directions_.end();
+}
+
+bool Inventory::exists(const Direction &direction,
+                       const std::string &tier) const {
+  auto query = directions_.find(direction);
+  return query != directions_.end() and query->second.count(tier) != 0;
+}
+
+const Direction &Inventory::default_direction() const {
+  return default_direction_;
+}
+
+bool Inventory::Equal::operator()(const Direction &lhs,
+                                  const Direction &rhs) const {
+  return lhs.source == rhs.source && lhs.target == rhs.target;
+}
+
+size_t Inventory::Hash::operator()(const Direction &direction) const {
+  auto hash_combine = [](size_t &seed, size_t next) {
+    seed ^= (std::hash<size_t>{}(next) //
+             + 0x9e3779b9              // NOLINT
+             + (seed << 6)             // NOLINT
+             + (seed >> 2)             // NOLINT
+    );
+  };
+
+  size_t seed = std::hash<std::string>{}(direction.source);
+  hash_combine(seed, std::hash<std::string>{}(direction.target));
+  return seed;
+}
+
+YAML::Node Inventory::load(const std::string &path) {
+  YAML::Node tree = YAML::LoadFile(path);
+  return tree;
+}
+
+std::string ibus_slimt_t8n_config() {
+  namespace fs = std::filesystem;
+  fs::path home = std::getenv("HOME");
+
+  // Setup logging
+  // fs::path log_path = home / ".local" / "var" / "ibus-slimt-t8n.log";
+  // setup_logging(log_path.string());
+  // g_log("ibus-slimt-t8n",    //
+  //       G_LOG_LEVEL_MESSAGE, //
+  //       "Creating log at: %s", log_path.string().c_str());
+
+  // Pickup config-defaults.
+  fs::path config = home / ".config";
+  auto path = (config / "ibus-slimt-t8n.yml").string();
+  return path;
+}
+
+} // namespace ibus::slimt::t8n
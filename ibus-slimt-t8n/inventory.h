@@ -0,0 +1,141 @@
+#pragma once
+#include "ibus-slimt-t8n/model_cache.h"
+#include "slimt/slimt.hh"
+#include "yaml-cpp/yaml.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+template <class Field> struct Pair {
+  Field source;
+  Field target;
+};
+
+using Direction = Pair<std::string>;
+using Strings = std::vector<std::string>;
+using StringSet = std::set<std::string>;
+using Languages = Pair<StringSet>;
+
+template <class T> using Package = ::slimt::Package<T>;
+using Config = ::slimt::Config;
+using Model = ::slimt::Model;
+
+Direction reverse(const Direction &direction);
+
+class Inventory {
+public:
+  // Which tier renders the live preview, and which retranslates text on its
+  // way out, if any. A commit waits at most budget for the latter.
+  struct Tiers {
+    std::string preview = "tiny";
+    std::string commit;
+    std::chrono::milliseconds budget{150};
+  };
+
+  // How soon a keystroke retranslates the buffer, see RefreshScheduler. The
+  // engine aims to show a keystroke in the preedit within target.
+  struct Refresh {
+    std::chrono::milliseconds target{100};
+    std::string policy = "adaptive";
+  };
+
+  // What changed between two parses of the config. Models are named after
+  // their direction and tier.
+  struct Diff {
+    Strings added;
+    Strings removed;
+    Strings changed;
+    bool languages = false;
+    bool default_direction = false;
+    bool verify = false;
+    bool speculate = false;
+    bool tiers = false;
+    bool refresh = false;
+
+    bool empty() const;
+  };
+
+  explicit Inventory(const std::string &config_path);
+
+  static Diff diff(const Inventory &before, const Inventory &after);
+
+  // A direction can be served by several models, one per tier, named after
+  // their arch (e.g. tiny, base). When tier is missing for direction, the
+  // fastest model available is used instead.
+  std::shared_ptr<Model> query(const Direction &direction,
+                               const std::string &tier) const;
+  const Languages &languages() const;
+  bool verify() const { return verify_; }
+  bool speculate() const { return speculate_; }
+  bool exists(const Direction &direction) const;
+  bool exists(const Direction &direction, const std::string &tier) const;
+  const Direction &default_direction() const;
+  const Tiers &tiers() const { return tiers_; }
+  const Refresh &refresh() const { return refresh_; }
+
+  // Fingerprint of the model files serving direction at tier (path, size and
+  // modification time), 0 if there is no such model. Changes whenever the
+  // model on disk or its entry in the inventory does.
+  uint64_t identity(const Direction &direction, const std::string &tier) const;
+
+  // Fingerprint of a pivot through first and second.
+  static uint64_t identity(uint64_t first, uint64_t second);
+
+  // Every identity a chain built from this inventory can have.
+  std::unordered_set<uint64_t> identities() const;
+
+  // Every model the inventory can load.
+  std::vector<ModelSpec> specs() const;
+
+  // The parsed config, for sections the inventory does not interpret itself.
+  const YAML::Node &config() const { return inventory_; }
+
+private:
+  struct Hash {
+    size_t operator()(const Direction &direction) const;
+  };
+
+  struct Equal {
+    bool operator()(const Direction &lhs, const Direction &rhs) const;
+  };
+
+  // Entry serving direction at tier, with the fallback described at query.
+  const YAML::Node *find(const Direction &direction,
+                         const std::string &tier) const;
+
+  // The spec query(...) loads for an entry.
+  ModelSpec spec(const YAML::Node &config) const;
+
+  // Entries by tier.
+  using Tiered = std::map<std::string, YAML::Node>;
+
+  std::unordered_map<Direction, Tiered, Hash, Equal> directions_;
+  std::set<std::string> select_languages_;
+  Languages languages_;
+  Direction default_direction_;
+  Tiers tiers_;
+  Refresh refresh_;
+
+  // How model files are brought into memory, see ModelSpec.
+  bool mmap_ = true;
+  bool prefetch_ = true;
+
+  YAML::Node inventory_;
+  bool verify_;
+  bool speculate_ = true;
+  static YAML::Node load(const std::string &path);
+};
+
+// Where the config lives, ~/.config/ibus-slimt-t8n.yml.
+std::string ibus_slimt_t8n_config();
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace ibus::slimt::t8n {
+
+// Bounded map that evicts the least recently used entry once full. Not
+// thread-safe, callers are expected to serialize access.
+template <class Key, class Value, class Hash = std::hash<Key>> class LRU {
+public:
+  explicit LRU(size_t capacity) : capacity_(capacity) {}
+
+  // Returns a copy of the value stored for key, marking it most recently used.
+  std::optional<Value> get(const Key &key) {
+    auto query = index_.find(key);
+    if (query == index_.end()) {
+      return std::nullopt;
+    }
+    entries_.splice(entries_.begin(), entries_, query->second);
+    return query->second->second;
+  }
+
+  void put(const Key &key, Value value) {
+    auto query = index_.find(key);
+    if (query != index_.end()) {
+      query->second->second = std::move(value);
+      entries_.splice(entries_.begin(), entries_, query->second);
+      return;
+    }
+
+    entries_.emplace_front(key, std::move(value));
+    index_.emplace(key, entries_.begin());
+    while (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+  }
+
+  void clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  size_t size() const { return entries_.size(); }
+
+private:
+  using Entry = std::pair<Key, Value>;
+
+  size_t capacity_;
+  std::list<Entry> entries_;
+  std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -1,16 +1,65 @@
 #include "ibus-slimt-t8n/application.h"
+#include "ibus-slimt-t8n/calibrate.h"
 #include "ibus-slimt-t8n/engine_compat.h"
+#include "ibus-slimt-t8n/server.h"
+#include <csignal>
+#include <glib-unix.h>
 #include <ibus.h>
 
+namespace {
+
+// Serves translations to engines configured to go through a server, until
+// interrupted.
+int serve(const char *socket_path) {
+  using namespace ibus::slimt::t8n; // NOLINT
+  std::string config = ibus_slimt_t8n_config();
+  Service::host();
+
+  std::shared_ptr<Service> service = Service::shared(config);
+  std::string socket =
+      socket_path != nullptr
+          ? socket_path
+          : ibus_slimt_t8n_socket(service->inventory()->config());
+  Server server(config, socket);
+  if (not server.listen()) {
+    return 1;
+  }
+
+  GMainLoop *loop = g_main_loop_new(nullptr, FALSE);
+  auto quit = +[](gpointer data) -> gboolean {
+    g_main_loop_quit(static_cast<GMainLoop *>(data));
+    return G_SOURCE_REMOVE;
+  };
+  // Quit through the main loop, so the socket is cleaned up on the way out.
+  g_unix_signal_add(SIGINT, quit, loop);
+  g_unix_signal_add(SIGTERM, quit, loop);
+  g_main_loop_run(loop);
+  g_main_loop_unref(loop);
+  return 0;
+}
+
+} // namespace
+
 int main(int argc, char **argv) {
   /* command line options */
   gboolean ibus = FALSE;
   gboolean verbose = FALSE;
+  gboolean server = FALSE;
+  gboolean calibrate = FALSE;
+  gchar *socket_path = nullptr;
 
   const GOptionEntry entries[] = {
       {"ibus", 'i', 0, G_OPTION_ARG_NONE, &ibus,
        "component is executed by ibus", nullptr},
       {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, "verbose", nullptr},
+      {"serve", 's', 0, G_OPTION_ARG_NONE, &server,
+       "serve translations over a unix socket instead of running as an engine",
+       nullptr},
+      {"socket", 0, 0, G_OPTION_ARG_FILENAME, &socket_path,
+       "socket to serve on, overrides the config", "PATH"},
+      {"calibrate", 'c', 0, G_OPTION_ARG_NONE, &calibrate,
+       "time worker settings on this machine and write the best to the config",
+       nullptr},
       {nullptr},
   };
 
@@ -27,6 +76,15 @@ int main(int argc, char **argv) {
     return (-1);
   }
 
+  if (calibrate) {
+    std::string config = ibus::slimt::t8n::ibus_slimt_t8n_config();
+    return ibus::slimt::t8n::calibrate(config);
+  }
+
+  if (server) {
+    return serve(socket_path);
+  }
+
   ibus::slimt::t8n::Application application(ibus);
   ibus::slimt::t8n::Application::run();
   return 0;
@@ -0,0 +1,28 @@
+#pragma once
+#include <glib.h>
+#include <utility>
+
+namespace ibus::slimt::t8n {
+
+// Queues fn to run on the default GLib main context, where IBus expects all
+// engine calls to happen. Safe to call from any thread. fn always runs from
+// the loop, never inline on the caller, even if the caller could acquire the
+// context (g_main_context_invoke would run it right there). If the loop never
+// runs again, neither does fn. fn is moved to the heap as is, without
+// wrapping it in a std::function first.
+template <class Fn> void invoke_on_main(Fn fn) {
+  auto *payload = new Fn(std::move(fn));
+  GSource *source = g_idle_source_new();
+  g_source_set_priority(source, G_PRIORITY_DEFAULT);
+  g_source_set_callback(
+      source,
+      +[](gpointer data) -> gboolean {
+        (*static_cast<Fn *>(data))();
+        return G_SOURCE_REMOVE;
+      },
+      payload, +[](gpointer data) { delete static_cast<Fn *>(data); });
+  g_source_attach(source, g_main_context_default());
+  g_source_unref(source);
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,148 @@
+#include "ibus-slimt-t8n/mapped_file.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+MappedFile::MappedFile(std::string path, void *data, size_t size)
+    : path_(std::move(path)), data_(data), size_(size) {}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    ::munmap(data_, size_);
+  }
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path,
+                                             bool prefetch) {
+  auto fail = [&path](const char *what) {
+    throw std::runtime_error("Unable to " + std::string(what) + " " + path +
+                             ": " + std::strerror(errno));
+  };
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fail("open");
+  }
+
+  struct stat info {};
+  if (::fstat(fd, &info) != 0) {
+    ::close(fd);
+    fail("stat");
+  }
+
+  constexpr int64_t kNanoseconds = 1000000000;
+  Identity identity{
+      .device = static_cast<uint64_t>(info.st_dev), //
+      .inode = static_cast<uint64_t>(info.st_ino),  //
+      .size = static_cast<uint64_t>(info.st_size),  //
+      .mtime = info.st_mtim.tv_sec * kNanoseconds + info.st_mtim.tv_nsec //
+  };
+
+  Registry &files = registry();
+  std::lock_guard<std::mutex> lock(files.mutex);
+  auto query = files.files.find(identity);
+  if (query != files.files.end()) {
+    if (std::shared_ptr<MappedFile> mapped = query->second.lock()) {
+      ::close(fd);
+      ++files.shared;
+      return mapped;
+    }
+  }
+
+  // mmap refuses empty mappings, but an empty file is still a valid file.
+  auto size = static_cast<size_t>(info.st_size);
+  void *data = nullptr;
+  if (size > 0) {
+    data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+      ::close(fd);
+      fail("map");
+    }
+
+    if (prefetch) {
+      // Best effort: WILLNEED schedules reads without blocking, readahead
+      // gets the first chunk going even where the hint is ignored.
+      ::madvise(data, size, MADV_WILLNEED);
+      ::readahead(fd, 0, size);
+    }
+  }
+  ::close(fd);
+
+  std::shared_ptr<MappedFile> mapped(new MappedFile(path, data, size));
+  files.files[identity] = mapped;
+
+  // Drop entries for files nobody maps anymore.
+  for (auto it = files.files.begin(); it != files.files.end();) {
+    it = it->second.expired() ? files.files.erase(it) : std::next(it);
+  }
+
+  LOG("Mapped %s (%zu bytes)", path.c_str(), size);
+  return mapped;
+}
+
+size_t MappedFile::resident() const {
+  if (data_ == nullptr) {
+    return 0;
+  }
+
+  auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  std::vector<unsigned char> pages((size_ + page - 1) / page);
+  if (::mincore(data_, size_, pages.data()) != 0) {
+    return 0;
+  }
+
+  size_t count = std::count_if(pages.begin(), pages.end(),
+                               [](unsigned char page) { return page & 1; });
+  return std::min(count * page, size_);
+}
+
+MappedFile::Stats MappedFile::stats() {
+  Registry &files = registry();
+  std::lock_guard<std::mutex> lock(files.mutex);
+  Stats stats;
+  stats.shared = files.shared;
+  for (const auto &[identity, weak] : files.files) {
+    if (std::shared_ptr<MappedFile> mapped = weak.lock()) {
+      ++stats.files;
+      stats.bytes += mapped->size();
+    }
+  }
+  return stats;
+}
+
+bool MappedFile::Identity::operator==(const Identity &other) const {
+  return device == other.device && inode == other.inode &&
+         size == other.size && mtime == other.mtime;
+}
+
+size_t MappedFile::Hash::operator()(const Identity &identity) const {
+  auto hash_combine = [](size_t &seed, size_t next) {
+    seed ^= (std::hash<size_t>{}(next) //
+             + 0x9e3779b9              // NOLINT
+             + (seed << 6)             // NOLINT
+             + (seed >> 2)             // NOLINT
+    );
+  };
+
+  size_t seed = std::hash<uint64_t>{}(identity.inode);
+  hash_combine(seed, identity.device);
+  hash_combine(seed, identity.size);
+  hash_combine(seed, static_cast<size_t>(identity.mtime));
+  return seed;
+}
+
+MappedFile::Registry &MappedFile::registry() {
+  static Registry registry;
+  return registry;
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ibus::slimt::t8n {
+
+// A file mapped read-only and shared, so its pages live in the page cache
+// once no matter how many models or engine processes use it.
+class MappedFile {
+public:
+  // Maps path, or returns the existing mapping if the same file (by device,
+  // inode, size and modification time) is already mapped in this process.
+  // With prefetch, the kernel is asked to read the file in right away, so the
+  // first translation does not fault its way through the model. Throws
+  // std::runtime_error if the file cannot be mapped.
+  static std::shared_ptr<MappedFile> open(const std::string &path,
+                                          bool prefetch);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile();
+
+  void *data() const { return data_; }
+  size_t size() const { return size_; }
+  const std::string &path() const { return path_; }
+
+  // Bytes of the file in memory right now, by mincore(2).
+  size_t resident() const;
+
+  struct Stats {
+    // Distinct files mapped right now, and their total size.
+    size_t files = 0;
+    size_t bytes = 0;
+    // Calls to open(...) served by an existing mapping.
+    size_t shared = 0;
+  };
+
+  static Stats stats();
+
+private:
+  MappedFile(std::string path, void *data, size_t size);
+
+  struct Identity {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+
+    bool operator==(const Identity &other) const;
+  };
+
+  struct Hash {
+    size_t operator()(const Identity &identity) const;
+  };
+
+  struct Registry {
+    std::mutex mutex;
+    std::unordered_map<Identity, std::weak_ptr<MappedFile>, Hash> files;
+    size_t shared = 0;
+  };
+
+  static Registry &registry();
+
+  std::string path_;
+  void *data_;
+  size_t size_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,362 @@
+#include "ibus-slimt-t8n/model_cache.h"
+#include "ibus-slimt-t8n/logging.h"
+#include "ibus-slimt-t8n/mapped_file.h"
+#include <algorithm>
+#include <filesystem>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+::slimt::Model::Config preset(const std::string &arch) {
+  if (arch == "base") {
+    return ::slimt::preset::base();
+  }
+  if (arch == "nano") {
+    return ::slimt::preset::nano();
+  }
+  if (arch != "tiny") {
+    LOG("Unknown arch %s, assuming tiny", arch.c_str());
+  }
+  return ::slimt::preset::tiny();
+}
+
+// A model built over mapped files, which have to outlive it.
+struct MappedModel {
+  std::shared_ptr<MappedFile> model;
+  std::shared_ptr<MappedFile> vocabulary;
+  std::shared_ptr<MappedFile> shortlist;
+  std::unique_ptr<::slimt::Model> instance;
+};
+
+::slimt::View view(const MappedFile &file) {
+  return ::slimt::View{.data = file.data(), .size = file.size()};
+}
+
+} // namespace
+
+ModelCache::Loaded ModelCache::load(const ModelSpec &spec) {
+  LOG("model_path: %s (%s)", spec.path.model.c_str(), spec.arch.c_str());
+  ::slimt::Model::Config arch = preset(spec.arch);
+  Loaded loaded;
+  if (!spec.mmap) {
+    namespace fs = std::filesystem;
+    for (const std::string *path :
+         {&spec.path.model, &spec.path.vocabulary, &spec.path.shortlist}) {
+      std::error_code ec;
+      loaded.size += fs::file_size(*path, ec);
+    }
+    loaded.model = std::make_shared<::slimt::Model>(arch, spec.path);
+    return loaded;
+  }
+
+  // Files shared with other models (a vocabulary used by both directions,
+  // say) are only mapped once.
+  auto mapped = std::make_shared<MappedModel>();
+  mapped->model = MappedFile::open(spec.path.model, spec.prefetch);
+  mapped->vocabulary = MappedFile::open(spec.path.vocabulary, spec.prefetch);
+  mapped->shortlist = MappedFile::open(spec.path.shortlist, spec.prefetch);
+
+  ::slimt::Package<::slimt::View> package{
+      .model = view(*mapped->model),           //
+      .vocabulary = view(*mapped->vocabulary), //
+      .shortlist = view(*mapped->shortlist)    //
+  };
+  mapped->instance = std::make_unique<::slimt::Model>(arch, package);
+
+  loaded.files = {mapped->model, mapped->vocabulary, mapped->shortlist};
+  for (const auto &file : loaded.files) {
+    loaded.size += file->size();
+  }
+
+  // Points at the model, keeps the whole bundle alive.
+  loaded.model = ModelPtr(mapped, mapped->instance.get());
+  return loaded;
+}
+
+ModelCache::ModelPtr ModelCache::get(const ModelSpec &spec) {
+  std::promise<ModelPtr> promise;
+  std::shared_future<ModelPtr> model;
+  bool loader = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto query = models_.find(spec);
+    if (query != models_.end()) {
+      ++stats_.hits;
+      query->second.used = Clock::now();
+      model = query->second.model;
+    } else {
+      ++stats_.misses;
+      model = promise.get_future().share();
+      Entry &entry = models_[spec];
+      entry.model = model;
+      entry.used = Clock::now();
+      loader = true;
+    }
+  }
+
+  if (loader) {
+    // Load outside the lock, so unrelated models can load concurrently.
+    auto start = Clock::now();
+    Loaded loaded;
+    try {
+      loaded = load(spec);
+    } catch (...) {
+      // Let the next caller retry instead of caching the failure.
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        models_.erase(spec);
+      }
+      promise.set_exception(std::current_exception());
+      return model.get();
+    }
+
+    auto elapsed =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                              start);
+    size_t cap = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Entry &entry = models_[spec];
+      entry.pointer = loaded.model.get();
+      entry.files = std::move(loaded.files);
+      entry.size = loaded.size;
+      entry.used = Clock::now();
+      stats_.load_time += elapsed;
+      cap = limits_.models;
+      LOG("Loaded %s in %.2f ms (%zu hits, %zu misses)",
+          spec.path.model.c_str(), elapsed.count() / 1000.0, stats_.hits,
+          stats_.misses);
+    }
+    ModelPtr result = loaded.model;
+    promise.set_value(std::move(loaded.model));
+
+    if (cap != 0) {
+      // Held by result, so never the one to go.
+      evict_unused(cap);
+    }
+    return result;
+  }
+
+  return model.get();
+}
+
+void ModelCache::touch(const ::slimt::Model *model) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &[spec, entry] : models_) {
+    if (entry.pointer == model) {
+      entry.used = Clock::now();
+      return;
+    }
+  }
+}
+
+void ModelCache::configure(const Limits &limits) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+  }
+  if (limits.models != 0) {
+    evict_unused(limits.models);
+  }
+}
+
+ModelCache::Limits ModelCache::limits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return limits_;
+}
+
+size_t ModelCache::evict_idle() {
+  std::chrono::seconds idle = limits().idle;
+  return idle.count() > 0 ? evict_idle(idle) : 0;
+}
+
+size_t ModelCache::evict_idle(std::chrono::seconds idle) {
+  auto threshold = Clock::now() - idle;
+  return evict(
+      [threshold](const Entries &entries) {
+        std::vector<ModelSpec> victims;
+        for (const auto &[spec, entry] : entries) {
+          if (entry.pointer && entry.used < threshold) {
+            victims.push_back(spec);
+          }
+        }
+        return victims;
+      },
+      "idle");
+}
+
+size_t ModelCache::evict_unused(size_t keep) {
+  return evict(
+      [keep](const Entries &entries) {
+        // Someone besides the cache holds on to the model, or is about to: it
+        // only just loaded.
+        auto held = [](const Entry &entry) {
+          auto now = std::chrono::seconds(0);
+          return entry.model.wait_for(now) != std::future_status::ready or
+                 entry.model.get().use_count() > 1;
+        };
+
+        std::vector<std::pair<Clock::time_point, ModelSpec>> unused;
+        size_t used = 0;
+        for (const auto &[spec, entry] : entries) {
+          if (not entry.pointer) {
+            continue;
+          }
+          if (held(entry)) {
+            ++used;
+          } else {
+            unused.emplace_back(entry.used, spec);
+          }
+        }
+
+        if (used > keep) {
+          LOG("Keeping %zu models in use loaded, over the limit of %zu", used,
+              keep);
+        }
+
+        std::vector<ModelSpec> victims;
+        size_t room = used < keep ? keep - used : 0;
+        if (unused.size() <= room) {
+          return victims;
+        }
+
+        // Oldest first.
+        std::sort(unused.begin(), unused.end(),
+                  [](const auto &lhs, const auto &rhs) {
+                    return lhs.first < rhs.first;
+                  });
+        for (size_t i = 0; i < unused.size() - room; i++) {
+          victims.push_back(unused[i].second);
+        }
+        return victims;
+      },
+      "over limit");
+}
+
+size_t ModelCache::evict(const std::vector<ModelSpec> &specs) {
+  return evict(
+      [&specs](const Entries &entries) {
+        std::vector<ModelSpec> victims;
+        for (const ModelSpec &spec : specs) {
+          auto query = entries.find(spec);
+          if (query != entries.end() && query->second.pointer) {
+            victims.push_back(spec);
+          }
+        }
+        return victims;
+      },
+      "removed from config");
+}
+
+size_t ModelCache::evict(const Victims &victims, const char *reason) {
+  Evicted evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const ModelSpec &spec : victims(models_)) {
+      auto query = models_.find(spec);
+      const Entry &entry = query->second;
+      auto idle = std::chrono::duration_cast<std::chrono::seconds>(
+          Clock::now() - entry.used);
+      LOG("Evicting %s (%s, %zu bytes, idle %ld s): %s",
+          spec.path.model.c_str(), spec.arch.c_str(), entry.size,
+          static_cast<long>(idle.count()), reason);
+      evicted.insert(entry.pointer);
+      models_.erase(query);
+    }
+    stats_.evictions += evicted.size();
+  }
+
+  if (!evicted.empty()) {
+    // Memory is only released once holders let go too.
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    for (auto &[id, listener] : listeners_) {
+      listener(evicted);
+    }
+  }
+  return evicted.size();
+}
+
+size_t ModelCache::subscribe(Listener listener) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  size_t id = next_listener_++;
+  listeners_.emplace(id, std::move(listener));
+  return id;
+}
+
+void ModelCache::unsubscribe(size_t id) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  listeners_.erase(id);
+}
+
+ModelCache::Stats ModelCache::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+std::vector<ModelCache::Resident> ModelCache::residents() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Resident> residents;
+  auto now = Clock::now();
+  for (const auto &[spec, entry] : models_) {
+    if (!entry.pointer) {
+      continue;
+    }
+
+    Resident resident{
+        .path = spec.path.model, //
+        .arch = spec.arch,       //
+        .size = entry.size,      //
+        .resident = 0,           //
+        .idle = std::chrono::duration_cast<std::chrono::seconds>(
+            now - entry.used) //
+    };
+
+    if (entry.files.empty()) {
+      resident.resident = entry.size;
+    } else {
+      for (const auto &file : entry.files) {
+        resident.resident += file->resident();
+      }
+    }
+    residents.push_back(std::move(resident));
+  }
+  return residents;
+}
+
+size_t ModelCache::Hash::operator()(const ModelSpec &spec) const {
+  auto hash_combine = [](size_t &seed, size_t next) {
+    seed ^= (std::hash<size_t>{}(next) //
+             + 0x9e3779b9              // NOLINT
+             + (seed << 6)             // NOLINT
+             + (seed >> 2)             // NOLINT
+    );
+  };
+
+  size_t seed = std::hash<std::string>{}(spec.path.model);
+  hash_combine(seed, std::hash<std::string>{}(spec.path.vocabulary));
+  hash_combine(seed, std::hash<std::string>{}(spec.path.shortlist));
+  hash_combine(seed, std::hash<std::string>{}(spec.arch));
+  hash_combine(seed, static_cast<size_t>(spec.mmap));
+  hash_combine(seed, static_cast<size_t>(spec.prefetch));
+  return seed;
+}
+
+bool ModelCache::Equal::operator()(const ModelSpec &lhs,
+                                   const ModelSpec &rhs) const {
+  return lhs == rhs;
+}
+
+bool operator==(const ModelSpec &lhs, const ModelSpec &rhs) {
+  return lhs.path.model == rhs.path.model &&
+         lhs.path.vocabulary == rhs.path.vocabulary &&
+         lhs.path.shortlist == rhs.path.shortlist && lhs.arch == rhs.arch &&
+         lhs.mmap == rhs.mmap && lhs.prefetch == rhs.prefetch;
+}
+
+ModelCache &model_cache() {
+  static ModelCache cache;
+  return cache;
+}
+
+} // namespace ibus::slimt::t8n
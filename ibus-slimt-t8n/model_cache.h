@@ -0,0 +1,149 @@
+#pragma once
+#include "ibus-slimt-t8n/mapped_file.h"
+#include "slimt/slimt.hh"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Files on disk that make up a model and the architecture they were trained
+// with, resolved from an inventory entry. Two entries resolving to the same
+// spec share one loaded model.
+struct ModelSpec {
+  ::slimt::Package<std::string> path;
+  std::string arch = "tiny";
+
+  // Map the files instead of reading them into the heap, see MappedFile.
+  bool mmap = true;
+  bool prefetch = true;
+};
+
+bool operator==(const ModelSpec &lhs, const ModelSpec &rhs);
+
+// Process-wide store of loaded models, so chains (forward, backward, pivot
+// legs) and repeated set_direction(...) calls reuse what is already in memory
+// instead of going back to disk.
+//
+// Models can be evicted: when more than a configured number are loaded, when
+// unused for a while, or when the system runs low on memory. Eviction drops
+// the cache's reference and tells subscribers, who are expected to drop
+// theirs and come back through get(...) on next use.
+class ModelCache {
+public:
+  using ModelPtr = std::shared_ptr<::slimt::Model>;
+  using Clock = std::chrono::steady_clock;
+  using Evicted = std::unordered_set<const ::slimt::Model *>;
+  using Listener = std::function<void(const Evicted &)>;
+
+  struct Limits {
+    // Most models kept loaded, 0 for no limit. Least recently used go first,
+    // models in use never do, see evict_unused(...).
+    size_t models = 0;
+    // Models unused for longer are evicted by evict_idle(), 0 to keep them.
+    std::chrono::seconds idle{0};
+  };
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    // Wall-clock time spent loading on misses.
+    std::chrono::microseconds load_time{0};
+  };
+
+  // A loaded model, as seen from outside.
+  struct Resident {
+    std::string path;
+    std::string arch;
+    // Bytes of model, vocabulary and shortlist files, and how many of those
+    // are in memory right now. Files read into the heap count in full.
+    size_t size = 0;
+    size_t resident = 0;
+    std::chrono::seconds idle{0};
+  };
+
+  // Returns the model for spec, loading it on first use. Concurrent callers
+  // asking for the same spec wait on a single load.
+  ModelPtr get(const ModelSpec &spec);
+
+  // Records a use of model, for idle and least recently used eviction.
+  void touch(const ::slimt::Model *model);
+
+  void configure(const Limits &limits);
+  Limits limits() const;
+
+  // Evicts models unused for longer than idle, or the configured timeout.
+  // Returns how many were evicted.
+  size_t evict_idle();
+  size_t evict_idle(std::chrono::seconds idle);
+
+  // Evicts all but the keep most recently used models. Models held outside
+  // the cache (by the chains translators are using, say) count towards keep
+  // and stay, however many there are: evicting one would only have it
+  // reloaded, evicting the next.
+  size_t evict_unused(size_t keep);
+
+  // Evicts the models for specs, if loaded.
+  size_t evict(const std::vector<ModelSpec> &specs);
+
+  // listener is called with the models evicted, from whichever thread evicts
+  // them. unsubscribe(...) waits for a call in progress to return.
+  size_t subscribe(Listener listener);
+  void unsubscribe(size_t id);
+
+  Stats stats() const;
+  std::vector<Resident> residents() const;
+
+private:
+  struct Hash {
+    size_t operator()(const ModelSpec &spec) const;
+  };
+
+  struct Equal {
+    bool operator()(const ModelSpec &lhs, const ModelSpec &rhs) const;
+  };
+
+  struct Entry {
+    std::shared_future<ModelPtr> model;
+    // Set once loaded. Models still loading are never evicted.
+    const ::slimt::Model *pointer = nullptr;
+    std::vector<std::shared_ptr<MappedFile>> files;
+    size_t size = 0;
+    Clock::time_point used;
+  };
+
+  struct Loaded {
+    ModelPtr model;
+    std::vector<std::shared_ptr<MappedFile>> files;
+    size_t size = 0;
+  };
+
+  static Loaded load(const ModelSpec &spec);
+
+  // Removes the entries victims picks out of the loaded ones, and tells
+  // subscribers about them.
+  using Entries = std::unordered_map<ModelSpec, Entry, Hash, Equal>;
+  using Victims = std::function<std::vector<ModelSpec>(const Entries &)>;
+  size_t evict(const Victims &victims, const char *reason);
+
+  mutable std::mutex mutex_;
+  Entries models_;
+  Limits limits_;
+  Stats stats_;
+
+  std::mutex listeners_mutex_;
+  std::unordered_map<size_t, Listener> listeners_;
+  size_t next_listener_ = 0;
+};
+
+ModelCache &model_cache();
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,421 @@
+#include "ibus-slimt-t8n/persistent_cache.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x4e385454; // NOLINT: "TT8N"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+constexpr size_t kRecordHeaderSize =
+    2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+template <class T> void put_bytes(std::string &buffer, T value) {
+  buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T> T get_bytes(const char *data) {
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+void serialize(std::string &buffer, uint64_t key, uint64_t identity,
+               std::string_view source, std::string_view target) {
+  put_bytes<uint64_t>(buffer, key);
+  put_bytes<uint64_t>(buffer, identity);
+  put_bytes<uint32_t>(buffer, source.size());
+  put_bytes<uint32_t>(buffer, target.size());
+  buffer.append(source);
+  buffer.append(target);
+}
+
+std::string header() {
+  std::string buffer;
+  put_bytes<uint32_t>(buffer, kMagic);
+  put_bytes<uint32_t>(buffer, kVersion);
+  return buffer;
+}
+
+bool write_fully(int fd, const std::string &buffer) {
+  size_t written = 0;
+  while (written < buffer.size()) {
+    ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+} // namespace
+
+uint64_t fnv1a(std::string_view data, uint64_t seed) {
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t hash = seed;
+  for (char c : data) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= kPrime;
+  }
+  return hash;
+}
+
+PersistentCache::PersistentCache(std::string path, size_t capacity,
+                                 std::unordered_set<uint64_t> live)
+    : path_(std::move(path)), capacity_(capacity), live_(std::move(live)) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!open()) {
+    return;
+  }
+
+  if (stale_ > 0 or size_ > capacity_) {
+    std::string temporary = path_ + ".tmp";
+    replace(temporary, write(temporary, compacted()));
+  }
+
+  LOG("Persistent cache %s: %zu records, %zu bytes", path_.c_str(),
+      records_.size(), size_);
+}
+
+PersistentCache::~PersistentCache() {
+  // Nothing calls put(...) anymore, so no compaction starts after this.
+  if (compactor_.joinable()) {
+    compactor_.join();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  close();
+}
+
+uint64_t PersistentCache::key(uint64_t identity, const std::string &source) {
+  return fnv1a(source, identity);
+}
+
+bool PersistentCache::open() {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::create_directories(fs::path(path_).parent_path(), ec);
+
+  fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (fd_ < 0) {
+    LOG("Unable to open persistent cache %s: %s", path_.c_str(),
+        std::strerror(errno));
+    return false;
+  }
+
+  // Anything we do not recognize (including an empty file) starts over.
+  char buffer[kHeaderSize];
+  bool valid = ::pread(fd_, buffer, kHeaderSize, 0) ==
+                   static_cast<ssize_t>(kHeaderSize) &&
+               get_bytes<uint32_t>(buffer) == kMagic &&
+               get_bytes<uint32_t>(buffer + sizeof(uint32_t)) == kVersion;
+  if (!valid) {
+    if (::ftruncate(fd_, 0) != 0 or !write_fully(fd_, header())) {
+      LOG("Unable to initialize persistent cache %s", path_.c_str());
+      close();
+      return false;
+    }
+  }
+
+  struct stat info {};
+  if (::fstat(fd_, &info) != 0) {
+    LOG("Unable to stat persistent cache %s: %s", path_.c_str(),
+        std::strerror(errno));
+    close();
+    return false;
+  }
+  mapped_ = info.st_size;
+  void *data = ::mmap(nullptr, mapped_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (data == MAP_FAILED) {
+    LOG("Unable to map persistent cache %s: %s", path_.c_str(),
+        std::strerror(errno));
+    close();
+    return false;
+  }
+
+  data_ = static_cast<char *>(data);
+  index();
+  return true;
+}
+
+void PersistentCache::close() {
+  if (data_) {
+    ::munmap(data_, mapped_);
+    data_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  mapped_ = 0;
+  size_ = 0;
+  stale_ = 0;
+  records_.clear();
+  appended_.clear();
+}
+
+void PersistentCache::index() {
+  size_t offset = kHeaderSize;
+  while (offset + kRecordHeaderSize <= mapped_) {
+    const char *cursor = data_ + offset;
+    auto key = get_bytes<uint64_t>(cursor);
+    auto identity = get_bytes<uint64_t>(cursor + sizeof(uint64_t));
+    auto source_size = get_bytes<uint32_t>(cursor + 2 * sizeof(uint64_t));
+    auto target_size = get_bytes<uint32_t>(cursor + 2 * sizeof(uint64_t) +
+                                           sizeof(uint32_t));
+
+    size_t end = offset + kRecordHeaderSize + source_size + target_size;
+    if (end > mapped_) {
+      break;
+    }
+
+    const char *source = cursor + kRecordHeaderSize;
+    Record record{
+        .identity = identity,                                          //
+        .source = std::string_view(source, source_size),               //
+        .target = std::string_view(source + source_size, target_size) //
+    };
+
+    if (live_.count(identity) == 0) {
+      ++stale_;
+    } else {
+      auto [where, inserted] = records_.insert_or_assign(key, record);
+      if (!inserted) {
+        ++stale_;
+      }
+    }
+    offset = end;
+  }
+
+  if (offset != mapped_) {
+    // A write was cut short, most likely by a crash. Drop the partial record
+    // so appends line up again.
+    LOG("Persistent cache %s: truncating partial record at %zu",
+        path_.c_str(), offset);
+    if (::ftruncate(fd_, offset) != 0) {
+      LOG("Unable to truncate persistent cache %s", path_.c_str());
+    }
+  }
+
+  size_ = offset;
+}
+
+std::string PersistentCache::compacted() const {
+  // Newest records survive. Anything appended since the file was mapped is
+  // newer than what is in the mapping, where records are ordered by offset.
+  std::vector<std::pair<uint64_t, const Record *>> mapped;
+  mapped.reserve(records_.size());
+  for (const auto &[key, record] : records_) {
+    if (appended_.count(key) == 0) {
+      mapped.emplace_back(key, &record);
+    }
+  }
+  std::sort(mapped.begin(), mapped.end(), [](const auto &lhs, const auto &rhs) {
+    return lhs.second->source.data() > rhs.second->source.data();
+  });
+
+  std::vector<std::pair<uint64_t, const Entry *>> appended;
+  appended.reserve(appended_.size());
+  for (const auto &[key, entry] : appended_) {
+    appended.emplace_back(key, &entry);
+  }
+  std::sort(appended.begin(), appended.end(),
+            [](const auto &lhs, const auto &rhs) {
+              return lhs.second->sequence > rhs.second->sequence;
+            });
+
+  // Leave half the capacity free, so compactions stay infrequent.
+  size_t budget = capacity_ / 2;
+  size_t used = kHeaderSize;
+  std::vector<std::string> kept;
+  auto keep = [&](uint64_t key, uint64_t identity, std::string_view source,
+                  std::string_view target) {
+    std::string buffer;
+    serialize(buffer, key, identity, source, target);
+    if (used + buffer.size() > budget) {
+      return false;
+    }
+    used += buffer.size();
+    kept.push_back(std::move(buffer));
+    return true;
+  };
+
+  bool room = true;
+  for (const auto &[key, entry] : appended) {
+    if (room) {
+      room = keep(key, entry->identity, entry->source, entry->target);
+    }
+  }
+  for (const auto &[key, record] : mapped) {
+    if (room) {
+      room = keep(key, record->identity, record->source, record->target);
+    }
+  }
+
+  // Written oldest first, matching the order an append-only file would have.
+  std::string contents = header();
+  for (auto it = kept.rbegin(); it != kept.rend(); ++it) {
+    contents += *it;
+  }
+  return contents;
+}
+
+bool PersistentCache::write(const std::string &temporary,
+                            const std::string &contents) {
+  int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0600);
+  bool written = fd >= 0 and write_fully(fd, contents);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  return written;
+}
+
+void PersistentCache::replace(const std::string &temporary, bool written) {
+  // Rename over the old file, so a crash midway leaves either the old or the
+  // new cache intact. Another process holding the old file keeps appending to
+  // the unlinked copy until it reopens.
+  size_t before = size_;
+  close();
+  if (!written or std::rename(temporary.c_str(), path_.c_str()) != 0) {
+    LOG("Unable to compact persistent cache %s", path_.c_str());
+    std::remove(temporary.c_str());
+  }
+
+  if (open()) {
+    LOG("Compacted persistent cache %s: %zu -> %zu bytes", path_.c_str(),
+        before, size_);
+  }
+}
+
+void PersistentCache::compact() {
+  std::string temporary = path_ + ".tmp";
+  std::string contents;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    contents = compacted();
+  }
+
+  bool written = write(temporary, contents);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  replace(temporary, written);
+
+  // The oldest of what does not fit is dropped, the memo upstream still has
+  // it. The rest goes in oldest first, as put(...) would have appended it.
+  std::vector<std::string> buffers(held_.size());
+  size_t first = held_.size();
+  size_t size = size_;
+  while (first > 0) {
+    const auto &[key, entry] = held_[first - 1];
+    std::string &buffer = buffers[first - 1];
+    serialize(buffer, key, entry.identity, entry.source, entry.target);
+    if (size + buffer.size() > capacity_) {
+      break;
+    }
+    size += buffer.size();
+    --first;
+  }
+  for (size_t i = first; fd_ >= 0 and i < held_.size(); ++i) {
+    append(held_[i].first, buffers[i], std::move(held_[i].second));
+  }
+  held_.clear();
+  compacting_ = false;
+}
+
+std::optional<std::string> PersistentCache::get(uint64_t identity,
+                                                const std::string &source) {
+  uint64_t k = key(identity, source);
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto appended = appended_.find(k);
+  if (appended != appended_.end()) {
+    const Entry &entry = appended->second;
+    if (entry.identity == identity and entry.source == source) {
+      return entry.target;
+    }
+    return std::nullopt;
+  }
+
+  auto query = records_.find(k);
+  if (query != records_.end()) {
+    const Record &record = query->second;
+    if (record.identity == identity and record.source == source) {
+      return std::string(record.target);
+    }
+  }
+  return std::nullopt;
+}
+
+void PersistentCache::put(uint64_t identity, const std::string &source,
+                          const std::string &target) {
+  uint64_t k = key(identity, source);
+  std::string buffer;
+  serialize(buffer, k, identity, source, target);
+
+  Entry entry{
+      .identity = identity, //
+      .source = source,     //
+      .target = target,     //
+      .sequence = 0         //
+  };
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (fd_ < 0) {
+    return;
+  }
+
+  if (compacting_) {
+    held_.emplace_back(k, std::move(entry));
+    return;
+  }
+
+  if (size_ + buffer.size() > capacity_) {
+    // Rewriting the file takes a while, which get(...) should not wait on.
+    // This record goes in after it.
+    compacting_ = true;
+    held_.emplace_back(k, std::move(entry));
+    if (compactor_.joinable()) {
+      compactor_.join(); // Done already, compacting_ was clear.
+    }
+    compactor_ = std::thread(&PersistentCache::compact, this);
+    return;
+  }
+
+  append(k, buffer, std::move(entry));
+}
+
+void PersistentCache::append(uint64_t key, const std::string &buffer,
+                             Entry entry) {
+  // A single write with O_APPEND, so concurrent writers do not interleave
+  // within a record.
+  if (!write_fully(fd_, buffer)) {
+    LOG("Unable to append to persistent cache %s", path_.c_str());
+    return;
+  }
+
+  size_ += buffer.size();
+  entry.sequence = ++appends_;
+  appended_.insert_or_assign(key, std::move(entry));
+}
+
+size_t PersistentCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return records_.size() + appended_.size();
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Stable across builds and processes, unlike std::hash.
+uint64_t fnv1a(std::string_view data, uint64_t seed = 0xcbf29ce484222325ULL);
+
+// Translations that outlive the process, kept in an append-only file which is
+// memory-mapped on open. Every record carries the identity of the model files
+// that produced it (see Inventory::identity), so records from a model that
+// has since been replaced or moved never hit, and are dropped on compaction.
+//
+// Layout: an 8-byte header (magic, version), followed by records of
+//
+//   u64 key | u64 identity | u32 source size | u32 target size | ...
+//
+// followed by source and target bytes, where key = fnv1a(source) seeded with
+// identity. A later record for a key
+// shadows an earlier one.
+class PersistentCache {
+public:
+  // live holds the identities of models currently in the inventory. The file
+  // is compacted on open if it holds anything else, or exceeds capacity. Once
+  // open, compactions run on a thread of their own so readers do not wait on
+  // the disk.
+  PersistentCache(std::string path, size_t capacity,
+                  std::unordered_set<uint64_t> live);
+  ~PersistentCache();
+
+  PersistentCache(const PersistentCache &) = delete;
+  PersistentCache &operator=(const PersistentCache &) = delete;
+
+  std::optional<std::string> get(uint64_t identity, const std::string &source);
+  void put(uint64_t identity, const std::string &source,
+           const std::string &target);
+
+  size_t size() const;
+
+private:
+  struct Record {
+    uint64_t identity;
+    std::string_view source;
+    std::string_view target;
+  };
+
+  struct Entry {
+    uint64_t identity;
+    std::string source;
+    std::string target;
+    // Set by append(...), higher for newer records.
+    uint64_t sequence = 0;
+  };
+
+  static uint64_t key(uint64_t identity, const std::string &source);
+
+  bool open();
+  void close();
+  void index();
+  void append(uint64_t key, const std::string &buffer, Entry entry);
+
+  // The compacted file, written to temporary before replace(...) renames it
+  // over path_. Only the first and last need mutex_.
+  std::string compacted() const;
+  static bool write(const std::string &temporary, const std::string &contents);
+  void replace(const std::string &temporary, bool written);
+
+  // All three in turn, on compactor_.
+  void compact();
+
+  std::string path_;
+  size_t capacity_;
+  std::unordered_set<uint64_t> live_;
+
+  int fd_ = -1;
+  char *data_ = nullptr;
+  size_t mapped_ = 0;
+  size_t size_ = 0;
+  size_t stale_ = 0;
+
+  // Records in the mapped region, and those appended since it was mapped.
+  std::unordered_map<uint64_t, Record> records_;
+  std::unordered_map<uint64_t, Entry> appended_;
+  uint64_t appends_ = 0;
+
+  // Records put while a compaction is writing, appended once it is done.
+  bool compacting_ = false;
+  std::vector<std::pair<uint64_t, Entry>> held_;
+  std::thread compactor_;
+
+  mutable std::mutex mutex_;
+};
+
+} // namespace ibus::slimt::t8n
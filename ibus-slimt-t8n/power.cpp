@@ -0,0 +1,144 @@
+#include "ibus-slimt-t8n/power.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+using Level = PowerProfile::Level;
+
+// First line of a sysfs attribute, empty if it cannot be read.
+std::string attribute(const std::filesystem::path &path) {
+  std::ifstream in(path);
+  std::string value;
+  std::getline(in, value);
+  return value;
+}
+
+std::string format(const char *format, double value) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), format, value);
+  return buffer;
+}
+
+} // namespace
+
+const char *PowerProfile::name() const {
+  switch (level) {
+  case Level::Full:
+    return "full";
+  case Level::Balanced:
+    return "balanced";
+  case Level::Saver:
+    return "saver";
+  }
+  return "";
+}
+
+size_t PowerProfile::workers(size_t configured) const {
+  switch (level) {
+  case Level::Full:
+    return configured;
+  case Level::Balanced:
+    return std::max<size_t>(1, configured / 2);
+  case Level::Saver:
+    return 1;
+  }
+  return configured;
+}
+
+RefreshScheduler::Policy PowerProfile::refresh() const {
+  switch (level) {
+  case Level::Full:
+    return RefreshScheduler::Policy::Every;
+  case Level::Balanced:
+    return RefreshScheduler::Policy::Debounced;
+  case Level::Saver:
+    return RefreshScheduler::Policy::Boundary;
+  }
+  return RefreshScheduler::Policy::Every;
+}
+
+bool PowerProfile::verify() const { return level != Level::Saver; }
+
+bool PowerProfile::speculate() const { return level == Level::Full; }
+
+PowerMonitor::PowerMonitor(Options options) : options_(std::move(options)) {
+  for (Level level : {Level::Full, Level::Balanced, Level::Saver}) {
+    PowerProfile profile;
+    profile.level = level;
+    if (options_.profile == profile.name()) {
+      pinned_ = level;
+    }
+  }
+
+  if (not pinned_ and options_.profile != "auto") {
+    LOG("Unknown power profile %s, following the machine instead",
+        options_.profile.c_str());
+  }
+}
+
+PowerMonitor::State PowerMonitor::read() const {
+  namespace fs = std::filesystem;
+  State state;
+
+  // A directory per supply, see the sysfs-class-power ABI.
+  std::error_code error;
+  for (const fs::directory_entry &supply :
+       fs::directory_iterator(options_.power_supply, error)) {
+    if (attribute(supply.path() / "type") != "Battery" or
+        attribute(supply.path() / "status") != "Discharging") {
+      continue;
+    }
+    state.battery = true;
+    try {
+      int capacity = std::stoi(attribute(supply.path() / "capacity"));
+      state.capacity = std::min(capacity, state.capacity.value_or(capacity));
+    } catch (const std::exception &) {
+      // Some batteries only report charge, not worth the arithmetic.
+    }
+  }
+
+  // e.g. 0.42 0.35 0.30 1/623 12345
+  std::ifstream loadavg(options_.loadavg);
+  double load = 0;
+  if (loadavg >> load) {
+    unsigned cores = std::max(1U, std::thread::hardware_concurrency());
+    state.load = load / cores;
+  }
+  return state;
+}
+
+PowerProfile PowerMonitor::choose(const State &state) const {
+  PowerProfile profile;
+  if (pinned_) {
+    profile.level = *pinned_;
+    profile.reason = "set in the config";
+    return profile;
+  }
+
+  std::string load =
+      state.load ? format("load %.2f per CPU", *state.load) : "load unknown";
+  if (state.battery) {
+    std::string battery =
+        state.capacity ? format("on battery at %.0f%%", *state.capacity)
+                       : "on battery";
+    bool low = state.capacity and *state.capacity <= options_.low_battery;
+    profile.level = low ? Level::Saver : Level::Balanced;
+    profile.reason = battery + ", " + load;
+  } else if (state.load and *state.load > options_.high_load) {
+    profile.level = Level::Balanced;
+    profile.reason = "on mains power, " + load;
+  } else {
+    profile.level = Level::Full;
+    profile.reason = "on mains power, " + load;
+  }
+  return profile;
+}
+
+} // namespace ibus::slimt::t8n
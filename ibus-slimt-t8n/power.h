@@ -0,0 +1,71 @@
+#pragma once
+#include "ibus-slimt-t8n/refresh_scheduler.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+
+namespace ibus::slimt::t8n {
+
+// How much the translation service may spend on keeping up with typing:
+//
+//   full      every configured worker, refreshes as eager as latency allows,
+//             backtranslation and speculation.
+//   balanced  half the workers, refreshes at most once typing pauses,
+//             backtranslation but no speculation.
+//   saver     one worker, refreshes at word boundaries, nothing extra.
+struct PowerProfile {
+  enum class Level { Full, Balanced, Saver };
+
+  Level level = Level::Full;
+  // Why it was picked, for logs.
+  std::string reason;
+
+  const char *name() const;
+  size_t workers(size_t configured) const;
+  // The most eager refresh policy allowed, see RefreshScheduler.
+  RefreshScheduler::Policy refresh() const;
+  bool verify() const;
+  bool speculate() const;
+
+  bool operator==(const PowerProfile &other) const {
+    return level == other.level;
+  }
+};
+
+// Picks a profile from the power supply and the load on the machine: saver on
+// a battery running low, balanced on battery or under heavy load, full
+// otherwise. Reads sysfs and procfs, at paths that can point elsewhere.
+class PowerMonitor {
+public:
+  struct Options {
+    // auto, or a profile to stay on whatever the machine does.
+    std::string profile = "auto";
+    // Saver on battery at or below this many percent.
+    int low_battery = 30;
+    // Balanced above this load average per CPU.
+    double high_load = 0.75;
+    std::string power_supply = "/sys/class/power_supply";
+    std::string loadavg = "/proc/loadavg";
+  };
+
+  struct State {
+    // Some battery is discharging.
+    bool battery = false;
+    // Of the emptiest battery discharging, in percent.
+    std::optional<int> capacity;
+    // Load average over the last minute, per CPU.
+    std::optional<double> load;
+  };
+
+  explicit PowerMonitor(Options options);
+
+  State read() const;
+  PowerProfile choose(const State &state) const;
+  PowerProfile sample() const { return choose(read()); }
+
+private:
+  Options options_;
+  std::optional<PowerProfile::Level> pinned_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace ibus::slimt::t8n {
+
+// What a request is for, which decides how soon the workers get to it, see
+// WorkQueue. In order of precedence.
+enum class Priority : uint8_t {
+  // The preview the user is waiting on, and text about to be committed.
+  Interactive = 0,
+  // Backtranslations verifying a preview.
+  Verify = 1,
+  // Speculation and bulk translation.
+  Background = 2,
+};
+
+constexpr size_t kPriorities = 3;
+
+inline const char *name(Priority priority) {
+  switch (priority) {
+  case Priority::Interactive:
+    return "interactive";
+  case Priority::Verify:
+    return "verify";
+  case Priority::Background:
+    return "background";
+  }
+  return "";
+}
+
+} // namespace ibus::slimt::t8n
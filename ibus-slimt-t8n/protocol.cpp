@@ -0,0 +1,159 @@
+#include "ibus-slimt-t8n/protocol.h"
+#include <cerrno>
+#include <concepts>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ibus::slimt::t8n::protocol {
+
+namespace {
+
+class Writer {
+public:
+  explicit Writer(uint32_t id, Kind kind) {
+    // Size is patched in once everything else is written.
+    put(uint32_t{0});
+    put(id);
+    buffer_.push_back(static_cast<char>(kind));
+  }
+
+  template <std::integral Int> void put(Int value) {
+    buffer_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  void put(std::string_view text) {
+    put(static_cast<uint32_t>(text.size()));
+    buffer_.append(text);
+  }
+
+  std::string finish() {
+    auto size = static_cast<uint32_t>(buffer_.size() - sizeof(uint32_t));
+    std::memcpy(buffer_.data(), &size, sizeof(size));
+    return std::move(buffer_);
+  }
+
+private:
+  std::string buffer_;
+};
+
+class Reader {
+public:
+  explicit Reader(std::string_view frame) : frame_(frame) {}
+
+  template <std::integral Int> bool get(Int &value) {
+    if (frame_.size() < sizeof(Int)) {
+      return false;
+    }
+    std::memcpy(&value, frame_.data(), sizeof(Int));
+    frame_.remove_prefix(sizeof(Int));
+    return true;
+  }
+
+  bool get(std::string &text) {
+    uint32_t size = 0;
+    if (!get(size) || frame_.size() < size) {
+      return false;
+    }
+    text.assign(frame_.data(), size);
+    frame_.remove_prefix(size);
+    return true;
+  }
+
+  bool done() const { return frame_.empty(); }
+
+private:
+  std::string_view frame_;
+};
+
+} // namespace
+
+std::string encode(const Request &request) {
+  Writer writer(request.id, Kind::Translate);
+  writer.put(request.source);
+  writer.put(request.target);
+  writer.put(request.tier);
+  writer.put(static_cast<uint8_t>(request.priority));
+  writer.put(request.text);
+  return writer.finish();
+}
+
+std::string encode(const Reply &reply) {
+  Writer writer(reply.id, reply.kind);
+  writer.put(reply.text);
+  return writer.finish();
+}
+
+bool decode(std::string_view frame, Request &request) {
+  Reader reader(frame);
+  uint8_t kind = 0;
+  uint8_t priority = 0;
+  bool valid = reader.get(request.id) && reader.get(kind) &&
+               kind == static_cast<uint8_t>(Kind::Translate) &&
+               reader.get(request.source) && reader.get(request.target) &&
+               reader.get(request.tier) && reader.get(priority) &&
+               priority < kPriorities && reader.get(request.text) &&
+               reader.done();
+  request.priority = static_cast<Priority>(priority);
+  return valid;
+}
+
+bool decode(std::string_view frame, Reply &reply) {
+  Reader reader(frame);
+  uint8_t kind = 0;
+  if (!reader.get(reply.id) || !reader.get(kind)) {
+    return false;
+  }
+  if (kind != static_cast<uint8_t>(Kind::Ok) &&
+      kind != static_cast<uint8_t>(Kind::Error)) {
+    return false;
+  }
+  reply.kind = static_cast<Kind>(kind);
+  return reader.get(reply.text) && reader.done();
+}
+
+namespace {
+
+bool read_all(int fd, char *data, size_t size) {
+  while (size > 0) {
+    ssize_t count = ::read(fd, data, size);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    data += count;
+    size -= count;
+  }
+  return true;
+}
+
+} // namespace
+
+bool read_frame(int fd, std::string &frame) {
+  uint32_t size = 0;
+  if (!read_all(fd, reinterpret_cast<char *>(&size), sizeof(size)) ||
+      size > kMaxFrame) {
+    return false;
+  }
+  frame.resize(size);
+  return read_all(fd, frame.data(), size);
+}
+
+bool write_all(int fd, std::string_view data) {
+  while (!data.empty()) {
+    // MSG_NOSIGNAL: a peer that went away is an error, not a SIGPIPE.
+    ssize_t count = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    data.remove_prefix(count);
+  }
+  return true;
+}
+
+} // namespace ibus::slimt::t8n::protocol
@@ -0,0 +1,53 @@
+#pragma once
+#include "ibus-slimt-t8n/priority.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace ibus::slimt::t8n::protocol {
+
+// Wire format between Client and Server. Both ends live on the same machine,
+// so integers go in host byte order. Every frame is
+//
+//   u32 size | u32 id | u8 kind | ...
+//
+// where size counts the bytes after it. Strings are a u32 size followed by
+// the bytes. A request (kind Translate) carries source, target, tier, a u8
+// priority and text, a reply (kind Ok or Error) carries the translation or an
+// error message. Requests can be pipelined; replies carry the id of their
+// request.
+
+// Frames larger than this are treated as a broken peer.
+constexpr uint32_t kMaxFrame = 16 * 1024 * 1024;
+
+enum class Kind : uint8_t { Translate = 1, Ok = 2, Error = 3 };
+
+struct Request {
+  uint32_t id = 0;
+  std::string source;
+  std::string target;
+  // Empty for the preview tier.
+  std::string tier;
+  Priority priority = Priority::Interactive;
+  std::string text;
+};
+
+struct Reply {
+  uint32_t id = 0;
+  Kind kind = Kind::Ok;
+  std::string text;
+};
+
+std::string encode(const Request &request);
+std::string encode(const Reply &reply);
+
+// Parse a frame as read by read_frame(...), false if it is malformed.
+bool decode(std::string_view frame, Request &request);
+bool decode(std::string_view frame, Reply &reply);
+
+// Blocking whole-frame I/O on a socket. Both return false on EOF or error.
+bool read_frame(int fd, std::string &frame);
+bool write_all(int fd, std::string_view data);
+
+} // namespace ibus::slimt::t8n::protocol
@@ -0,0 +1,89 @@
+#include "ibus-slimt-t8n/refresh_scheduler.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+// Translations up to this many times the target are worth waiting for a
+// pause, beyond that only for the end of a word.
+constexpr double kDebounced = 3.0;
+
+// Latency has to move this far past a threshold before the policy follows,
+// so an estimate hovering around one does not flip it every keystroke.
+constexpr double kHysteresis = 0.2;
+
+} // namespace
+
+RefreshScheduler::RefreshScheduler(std::chrono::milliseconds target,
+                                   const std::string &policy)
+    : target_(target) {
+  for (Policy pinned : {Policy::Every, Policy::Debounced, Policy::Boundary}) {
+    if (policy == name(pinned)) {
+      pinned_ = pinned;
+      policy_ = pinned;
+    }
+  }
+
+  if (!pinned_ and policy != "adaptive") {
+    LOG("Unknown refresh policy %s, adapting instead", policy.c_str());
+  }
+}
+
+bool RefreshScheduler::update(Milliseconds latency) {
+  if (pinned_) {
+    return false;
+  }
+
+  double ratio = latency / Milliseconds(target_);
+  auto classify = [](double ratio) {
+    if (ratio <= 1.0) {
+      return Policy::Every;
+    }
+    return (ratio <= kDebounced) ? Policy::Debounced : Policy::Boundary;
+  };
+
+  // Move to a slower policy only once well past its threshold, and back to a
+  // faster one only once well under.
+  Policy slower = classify(ratio / (1.0 + kHysteresis));
+  Policy faster = classify(ratio / (1.0 - kHysteresis));
+  Policy next = policy_;
+  if (slower > policy_) {
+    next = slower;
+  } else if (faster < policy_) {
+    next = faster;
+  }
+
+  bool changed = next != policy_;
+  policy_ = next;
+  return changed;
+}
+
+std::chrono::milliseconds RefreshScheduler::delay(bool boundary,
+                                                  Policy floor) const {
+  switch (std::max(policy_, floor)) {
+  case Policy::Every:
+    return std::chrono::milliseconds(0);
+  case Policy::Debounced:
+    // Most keystrokes in a word come quicker than this.
+    return target_ / 2;
+  case Policy::Boundary:
+    return boundary ? std::chrono::milliseconds(0) : 2 * target_;
+  }
+  return std::chrono::milliseconds(0);
+}
+
+const char *RefreshScheduler::name(Policy policy) {
+  switch (policy) {
+  case Policy::Every:
+    return "every";
+  case Policy::Debounced:
+    return "debounced";
+  case Policy::Boundary:
+    return "boundary";
+  }
+  return "";
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <optional>
+#include <string>
+
+namespace ibus::slimt::t8n {
+
+// Decides when a keystroke retranslates the buffer, so that the time from
+// keystroke to preedit stays near a target whatever the models cost:
+//
+//   every      on every key, when a translation fits in the target.
+//   debounced  once typing pauses, when it takes a few times the target.
+//   boundary   at word boundaries (space, punctuation), and once typing
+//              pauses for longer, when it is slower still.
+//
+// Fed with the measured cost of a translation, see Translator::latency().
+class RefreshScheduler {
+public:
+  enum class Policy { Every, Debounced, Boundary };
+
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  // policy is one of the names above to pin it, or "adaptive".
+  RefreshScheduler(std::chrono::milliseconds target, const std::string &policy);
+
+  // Picks the policy for latency, the cost of a translation. Returns true if
+  // the policy changed.
+  bool update(Milliseconds latency);
+
+  Policy policy() const { return policy_; }
+  std::chrono::milliseconds target() const { return target_; }
+
+  // How long after a keystroke to refresh: zero for right away. boundary is
+  // whether the key ends a word. floor is the most eager policy allowed, for
+  // when something else (e.g. the power profile) wants fewer refreshes.
+  std::chrono::milliseconds delay(bool boundary,
+                                  Policy floor = Policy::Every) const;
+
+  static const char *name(Policy policy);
+
+private:
+  std::chrono::milliseconds target_;
+  std::optional<Policy> pinned_;
+  Policy policy_ = Policy::Every;
+};
+
+} // namespace ibus::slimt::t8n
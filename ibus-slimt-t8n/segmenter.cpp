@@ -0,0 +1,104 @@
+#include "ibus-slimt-t8n/segmenter.h"
+#include <cassert>
+#include <cctype>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+bool is_space(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+bool is_terminal(char c) { return c == '.' || c == '!' || c == '?'; }
+
+} // namespace
+
+std::vector<Segment> segment(std::string_view text) {
+  std::vector<Segment> segments;
+  size_t begin = 0;
+  while (begin < text.size() && is_space(text[begin])) {
+    ++begin;
+  }
+
+  size_t i = begin;
+  while (i < text.size()) {
+    bool line_break = (text[i] == '\n');
+    bool boundary =
+        line_break ||
+        (is_terminal(text[i]) && i + 1 < text.size() && is_space(text[i + 1]));
+    if (!boundary) {
+      ++i;
+      continue;
+    }
+
+    // Whitespace is skipped after every boundary, so the sentence that ends
+    // here is never empty.
+    size_t end = line_break ? i : i + 1;
+    size_t next = end;
+    while (next < text.size() && is_space(text[next])) {
+      ++next;
+    }
+
+    segments.push_back(Segment{
+        .text = text.substr(begin, end - begin),   //
+        .separator = text.substr(end, next - end), //
+        .finished = true                           //
+    });
+
+    begin = next;
+    i = next;
+  }
+
+  if (begin < text.size()) {
+    size_t end = text.size();
+    while (end > begin && is_space(text[end - 1])) {
+      --end;
+    }
+    segments.push_back(Segment{
+        .text = text.substr(begin, end - begin), //
+        .separator = text.substr(end),           //
+        .finished = false                        //
+    });
+  }
+
+  return segments;
+}
+
+std::string normalize(std::string_view sentence) {
+  std::string normalized;
+  normalized.reserve(sentence.size());
+  bool space = false;
+  for (char c : sentence) {
+    if (is_space(c)) {
+      space = true;
+      continue;
+    }
+    if (space && !normalized.empty()) {
+      normalized += ' ';
+    }
+    space = false;
+    normalized += c;
+  }
+  return normalized;
+}
+
+bool touches(std::string_view text, const Segment &segment,
+             const Range &range) {
+  auto begin = static_cast<size_t>(segment.text.data() - text.data());
+  size_t end = begin + segment.text.size() + segment.separator.size();
+  return range.begin <= end and begin <= range.end;
+}
+
+std::string stitch(const std::vector<Segment> &segments,
+                   const std::vector<std::string> &targets) {
+  assert(segments.size() == targets.size());
+  std::string stitched;
+  for (size_t i = 0; i < segments.size(); i++) {
+    stitched += targets[i];
+    if (i + 1 < segments.size()) {
+      stitched += segments[i].separator;
+    }
+  }
+  return stitched;
+}
+
+} // namespace ibus::slimt::t8n
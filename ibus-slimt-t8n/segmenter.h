@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// A sentence in a buffer, with the whitespace that separates it from the next
+// one. Views point into the buffer that was segmented.
+struct Segment {
+  std::string_view text;
+  std::string_view separator;
+
+  // Whether the user has moved past this sentence: it ends in sentence-final
+  // punctuation and is followed by whitespace. The trailing sentence of a
+  // buffer being typed into is usually unfinished, and changes every key.
+  bool finished;
+};
+
+// Bytes [begin, end) of a buffer. An empty range still marks a position, e.g.
+// where something was deleted.
+struct Range {
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Whether range overlaps or borders segment, a segment of text.
+bool touches(std::string_view text, const Segment &segment, const Range &range);
+
+// Splits text into sentences at sentence-final punctuation followed by
+// whitespace, and at line breaks. Leading whitespace is skipped.
+std::vector<Segment> segment(std::string_view text);
+
+// Collapses runs of whitespace into a single space, so sentences that only
+// differ in spacing share a translation.
+std::string normalize(std::string_view sentence);
+
+// Joins translated sentences back with the separators of the source. Trailing
+// whitespace is not carried over.
+std::string stitch(const std::vector<Segment> &segments,
+                   const std::vector<std::string> &targets);
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,230 @@
+#include "ibus-slimt-t8n/server.h"
+#include "ibus-slimt-t8n/logging.h"
+#include "ibus-slimt-t8n/main_loop.h"
+#include "ibus-slimt-t8n/protocol.h"
+#include <cerrno>
+#include <cstring>
+#include <glib-unix.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace ibus::slimt::t8n {
+
+Server::Connection::Connection(int fd, const std::string &config_path)
+    : fd(fd), translator(config_path) {}
+
+Server::Connection::~Connection() { ::close(fd); }
+
+Server::Server(const std::string &config_path, std::string socket_path)
+    : config_path_(config_path), socket_path_(std::move(socket_path)),
+      service_(Service::shared(config_path)) {}
+
+Server::~Server() {
+  if (watch_ != 0) {
+    g_source_remove(watch_);
+  }
+
+  if (fd_ >= 0) {
+    ::close(fd_);
+    ::unlink(socket_path_.c_str());
+  }
+
+  // The main loop has stopped. Whatever the connection threads post from here
+  // on is queued but finds the server gone, so they are wound down directly,
+  // out of connections_ where nothing else can reach them.
+  alive_.reset();
+  std::map<uint64_t, std::unique_ptr<Connection>> connections;
+  connections.swap(connections_);
+  for (auto &[id, connection] : connections) {
+    ::shutdown(connection->fd, SHUT_RDWR);
+    {
+      std::lock_guard<std::mutex> lock(connection->mutex);
+      connection->closing = true;
+    }
+    connection->ready.notify_one();
+    connection->reader.join();
+    connection->writer.join();
+  }
+}
+
+bool Server::listen() {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(address.sun_path)) {
+    LOG("Socket path too long: %s", socket_path_.c_str());
+    return false;
+  }
+  std::memcpy(address.sun_path, socket_path_.c_str(), socket_path_.size());
+  auto *generic = reinterpret_cast<sockaddr *>(&address); // NOLINT
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG("Unable to create socket: %s", std::strerror(errno));
+    return false;
+  }
+
+  // A server that died leaves its socket behind. Only take it over if
+  // nobody answers on it.
+  if (::connect(fd, generic, sizeof(address)) == 0) {
+    LOG("A server is already listening on %s", socket_path_.c_str());
+    ::close(fd);
+    return false;
+  }
+  ::unlink(socket_path_.c_str());
+
+  if (::bind(fd, generic, sizeof(address)) < 0 or
+      ::chmod(socket_path_.c_str(), S_IRUSR | S_IWUSR) < 0 or
+      ::listen(fd, SOMAXCONN) < 0) {
+    LOG("Unable to listen on %s: %s", socket_path_.c_str(),
+        std::strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  fd_ = fd;
+  watch_ = g_unix_fd_add(
+      fd_, G_IO_IN,
+      +[](gint, GIOCondition, gpointer data) -> gboolean {
+        static_cast<Server *>(data)->accept();
+        return G_SOURCE_CONTINUE;
+      },
+      this);
+
+  LOG("Serving translations on %s", socket_path_.c_str());
+  return true;
+}
+
+void Server::accept() {
+  int fd = ::accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) {
+    LOG("Unable to accept: %s", std::strerror(errno));
+    return;
+  }
+
+  uint64_t id = next_id_++;
+  auto connection = std::make_unique<Connection>(fd, config_path_);
+  Connection &ref = *connection;
+  connections_.emplace(id, std::move(connection));
+  ref.reader = std::thread([this, id, &ref] { read(id, ref); });
+  ref.writer = std::thread([this, id, &ref] { write(id, ref); });
+  LOG("Client %lu connected, %zu connected", static_cast<unsigned long>(id),
+      connections_.size());
+}
+
+void Server::read(uint64_t id, Connection &connection) {
+  std::string frame;
+  while (protocol::read_frame(connection.fd, frame)) {
+    protocol::Request request;
+    if (not protocol::decode(frame, request)) {
+      LOG("Client %lu sent a malformed request, dropping it",
+          static_cast<unsigned long>(id));
+      break;
+    }
+
+    std::weak_ptr<bool> alive = alive_;
+    invoke_on_main([this, alive, id, request = std::move(request)]() mutable {
+      if (not alive.lock()) {
+        return;
+      }
+      auto query = connections_.find(id);
+      if (query == connections_.end()) {
+        return;
+      }
+
+      Connection &connection = *query->second;
+      Direction direction{
+          .source = std::move(request.source), //
+          .target = std::move(request.target)  //
+      };
+      std::future<std::string> future = connection.translator.submit(
+          direction, std::move(request.text), request.tier, request.priority);
+      {
+        std::lock_guard<std::mutex> lock(connection.mutex);
+        connection.replies.emplace_back(request.id, std::move(future));
+      }
+      connection.ready.notify_one();
+    });
+  }
+
+  // Lands after every request read above, so the writer answers them all
+  // before it stops.
+  std::weak_ptr<bool> alive = alive_;
+  invoke_on_main([this, alive, id]() {
+    if (not alive.lock()) {
+      return;
+    }
+    auto query = connections_.find(id);
+    if (query == connections_.end()) {
+      return;
+    }
+
+    Connection &connection = *query->second;
+    {
+      std::lock_guard<std::mutex> lock(connection.mutex);
+      connection.closing = true;
+    }
+    connection.ready.notify_one();
+  });
+}
+
+void Server::write(uint64_t id, Connection &connection) {
+  bool connected = true;
+  while (true) {
+    std::pair<uint32_t, std::future<std::string>> next;
+    {
+      std::unique_lock<std::mutex> lock(connection.mutex);
+      connection.ready.wait(lock, [&connection] {
+        return connection.closing or not connection.replies.empty();
+      });
+      if (connection.replies.empty()) {
+        break;
+      }
+      next = std::move(connection.replies.front());
+      connection.replies.pop_front();
+    }
+
+    protocol::Reply reply;
+    reply.id = next.first;
+    try {
+      reply.text = next.second.get();
+    } catch (const std::exception &e) {
+      reply.kind = protocol::Kind::Error;
+      reply.text = e.what();
+    }
+
+    if (connected and
+        not protocol::write_all(connection.fd, protocol::encode(reply))) {
+      // Gone. Stops the reader, keep draining until it is done.
+      connected = false;
+      ::shutdown(connection.fd, SHUT_RDWR);
+    }
+  }
+
+  std::weak_ptr<bool> alive = alive_;
+  invoke_on_main([this, alive, id] {
+    if (alive.lock()) {
+      reap(id);
+    }
+  });
+}
+
+void Server::reap(uint64_t id) {
+  auto query = connections_.find(id);
+  if (query == connections_.end()) {
+    return;
+  }
+
+  Connection &connection = *query->second;
+  connection.reader.join();
+  connection.writer.join();
+
+  Translator::Stats stats = connection.translator.stats();
+  connections_.erase(query);
+  LOG("Client %lu disconnected, %zu sentences, %zu memoized, %zu connected",
+      static_cast<unsigned long>(id), stats.sentences, stats.memoized,
+      connections_.size());
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,86 @@
+#pragma once
+#include "ibus-slimt-t8n/translator.h"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace ibus::slimt::t8n {
+
+// Hosts the translation service behind a Unix socket, so one warm set of
+// models serves every client on the machine, and a crash in model code takes
+// down the server instead of input. Clients talk the protocol in protocol.h,
+// see Client.
+//
+// Each connection gets a Translator of its own. Requests are read off the
+// socket on a thread per connection, submitted on the main loop (where
+// translators expect to be driven, and where config reloads land) and
+// answered in order by another thread as they complete, so a client can keep
+// many requests in flight.
+//
+// Must outlive the main loop it listens on.
+class Server {
+public:
+  Server(const std::string &config_path, std::string socket_path);
+  ~Server();
+
+  Server(const Server &) = delete;
+  Server &operator=(const Server &) = delete;
+
+  // Binds the socket and starts accepting on the main loop. False if the
+  // socket is taken by another server or cannot be bound.
+  bool listen();
+
+  const std::string &socket_path() const { return socket_path_; }
+
+private:
+  struct Connection {
+    Connection(int fd, const std::string &config_path);
+    ~Connection();
+
+    int fd;
+    Translator translator;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::pair<uint32_t, std::future<std::string>>> replies;
+    bool closing = false;
+
+    std::thread reader;
+    std::thread writer;
+  };
+
+  void accept();
+
+  // Connection threads. Both hop onto the main loop for anything touching
+  // the translator or the set of connections, naming the connection by id,
+  // since it may be gone by the time they land.
+  void read(uint64_t id, Connection &connection);
+  void write(uint64_t id, Connection &connection);
+
+  // On the main loop, once the writer is done.
+  void reap(uint64_t id);
+
+  std::string config_path_;
+  std::string socket_path_;
+
+  // Keeps the service, and with it the memo, warm between clients.
+  std::shared_ptr<Service> service_;
+
+  int fd_ = -1;
+  guint watch_ = 0;
+
+  uint64_t next_id_ = 0;
+  std::map<uint64_t, std::unique_ptr<Connection>> connections_;
+
+  // Hops onto the main loop still queued when the server goes check this,
+  // through a weak_ptr, before touching it.
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+};
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,409 @@
+#include "ibus-slimt-t8n/service.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+// Optional section, e.g.
+//
+//   priorities:
+//     inflight: 2 # verify and background sentences with the workers at once
+//     idle: 1 # workers at SCHED_IDLE for background work, 0 for none
+WorkQueue::Limits queue_limits(const YAML::Node &config) {
+  WorkQueue::Limits limits;
+  if (YAML::Node priorities = config["priorities"]) {
+    limits.inflight =
+        std::max<size_t>(1, priorities["inflight"].as<size_t>(limits.inflight));
+    limits.idle_workers = priorities["idle"].as<size_t>(limits.idle_workers);
+  }
+  return limits;
+}
+
+// Optional section, e.g.
+//
+//   power:
+//     profile: auto # or full, balanced, saver
+//     low_battery: 30 # percent, saver at or below
+//     high_load: 0.75 # load average per CPU, balanced above
+//     interval: 30 # seconds between checks
+//     power_supply: /sys/class/power_supply
+//     loadavg: /proc/loadavg
+PowerMonitor::Options power_options(const YAML::Node &config) {
+  PowerMonitor::Options options;
+  if (YAML::Node power = config["power"]) {
+    options.profile = power["profile"].as<std::string>(options.profile);
+    options.low_battery = power["low_battery"].as<int>(options.low_battery);
+    options.high_load = power["high_load"].as<double>(options.high_load);
+    options.power_supply =
+        power["power_supply"].as<std::string>(options.power_supply);
+    options.loadavg = power["loadavg"].as<std::string>(options.loadavg);
+  }
+  return options;
+}
+
+WorkQueue::Workers scale(WorkQueue::Workers workers,
+                         const PowerProfile &profile) {
+  workers.config.workers = profile.workers(workers.config.workers);
+  return workers;
+}
+
+// Set in the server process, see Service::host().
+std::atomic<bool> &hosting() {
+  static std::atomic<bool> hosting{false};
+  return hosting;
+}
+
+} // namespace
+
+std::shared_ptr<Service> Service::shared(const std::string &config_path) {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, std::weak_ptr<Service>> services;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::weak_ptr<Service> &weak = services[config_path];
+  std::shared_ptr<Service> service = weak.lock();
+  if (!service) {
+    LOG("Starting translation service for %s", config_path.c_str());
+    service = std::make_shared<Service>(config_path);
+    weak = service;
+  }
+  return service;
+}
+
+Service::Service(const std::string &config_path)
+    : config_path_(config_path),
+      inventory_(std::make_shared<const Inventory>(config_path)),
+      power_monitor_(power_options(inventory_->config())),
+      power_(std::make_shared<const PowerProfile>(power_monitor_.sample())),
+      workers_(ibus_slimt_t8n_workers(inventory_->config()).config.workers),
+      queue_(scale(ibus_slimt_t8n_workers(inventory_->config()), *power_),
+             queue_limits(inventory_->config())) {
+  LOG("Power profile %s: %s", power_->name(), power_->reason.c_str());
+  constexpr int64_t kPowerInterval = 30;
+  YAML::Node power = inventory_->config()["power"];
+  watch(std::chrono::seconds(
+      power ? power["interval"].as<int64_t>(kPowerInterval) : kPowerInterval));
+
+  // Optional section, e.g.
+  //
+  //   cache:
+  //     persistent: true
+  //     path: /home/user/.cache/ibus-slimt-t8n/translations.bin
+  //     size: 64 # MiB
+  YAML::Node cache = inventory_->config()["cache"];
+  if (cache and cache["persistent"].as<bool>(false)) {
+    namespace fs = std::filesystem;
+    constexpr size_t kMiB = 1024 * 1024;
+    constexpr size_t kDefaultSize = 64;
+
+    fs::path fallback = fs::path(g_get_user_cache_dir()) / "ibus-slimt-t8n" /
+                        "translations.bin";
+    auto path = cache["path"].as<std::string>(fallback.string());
+    size_t size = cache["size"].as<size_t>(kDefaultSize) * kMiB;
+    persistent_ = std::make_unique<PersistentCache>(path, size,
+                                                    inventory_->identities());
+  }
+
+  // Optional section, e.g.
+  //
+  //   memory:
+  //     models: 4 # most models kept loaded, 0 for no limit
+  //     idle: 600 # seconds before an unused model is unloaded, 0 for never
+  constexpr int64_t kDefaultIdle = 600;
+  ModelCache::Limits limits;
+  limits.idle = std::chrono::seconds(kDefaultIdle);
+  if (YAML::Node memory = inventory_->config()["memory"]) {
+    limits.models = memory["models"].as<size_t>(limits.models);
+    limits.idle = std::chrono::seconds(
+        memory["idle"].as<int64_t>(limits.idle.count()));
+  }
+  model_cache().configure(limits);
+  watch(limits);
+  watch(config_path);
+
+  // Optional section, e.g.
+  //
+  //   server:
+  //     remote: true # translate through `ibus-slimt-t8n --serve`
+  //     socket: /run/user/1000/ibus-slimt-t8n.sock
+  YAML::Node server = inventory_->config()["server"];
+  if (server and server["remote"].as<bool>(false) and not hosting()) {
+    std::string socket = ibus_slimt_t8n_socket(inventory_->config());
+    LOG("Translating through the server at %s", socket.c_str());
+    client_ = std::make_unique<Client>(socket);
+  }
+}
+
+void Service::host() { hosting() = true; }
+
+Service::~Service() {
+  if (reaper_ != 0) {
+    g_source_remove(reaper_);
+  }
+  if (power_timer_ != 0) {
+    g_source_remove(power_timer_);
+  }
+  if (debounce_ != 0) {
+    g_source_remove(debounce_);
+  }
+  if (config_monitor_ != nullptr) {
+    g_signal_handler_disconnect(config_monitor_, config_changed_);
+    g_object_unref(config_monitor_);
+  }
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  if (monitor_ != nullptr) {
+    g_signal_handler_disconnect(monitor_, pressure_);
+    g_object_unref(monitor_);
+  }
+#endif
+}
+
+void Service::watch(const ModelCache::Limits &limits) {
+  // Both run on the main loop. Neither touches the service, only the
+  // process-wide model cache.
+  if (limits.idle.count() > 0) {
+    // A few checks per timeout, so models go soon after it passes.
+    constexpr int64_t kChecks = 4;
+    auto interval =
+        static_cast<guint>(std::max<int64_t>(1, limits.idle.count() / kChecks));
+    reaper_ = g_timeout_add_seconds(
+        interval,
+        +[](gpointer) -> gboolean {
+          model_cache().evict_idle();
+          return G_SOURCE_CONTINUE;
+        },
+        nullptr);
+  }
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  auto on_warning = +[](GMemoryMonitor *, GMemoryMonitorWarningLevel level,
+                        gpointer) {
+    LOG("Low memory warning (%d)", static_cast<int>(level));
+    if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM) {
+      // Everything the chains are not using goes. Models in use stay, the
+      // next keystroke would only load them again.
+      model_cache().evict_unused(0);
+    } else {
+      constexpr std::chrono::seconds kRecent(60);
+      model_cache().evict_idle(kRecent);
+    }
+  };
+
+  monitor_ = g_memory_monitor_dup_default();
+  if (monitor_ != nullptr) {
+    pressure_ = g_signal_connect(monitor_, "low-memory-warning",
+                                 G_CALLBACK(on_warning), nullptr);
+  }
+#endif
+}
+
+void Service::watch(const std::string &config_path) {
+  GError *error = nullptr;
+  GFile *file = g_file_new_for_path(config_path.c_str());
+  config_monitor_ =
+      g_file_monitor_file(file, G_FILE_MONITOR_NONE, nullptr, &error);
+  g_object_unref(file);
+  if (config_monitor_ == nullptr) {
+    LOG("Unable to watch %s: %s", config_path.c_str(),
+        error ? error->message : "unknown error");
+    if (error) {
+      g_error_free(error);
+    }
+    return;
+  }
+
+  auto on_changed = +[](GFileMonitor *, GFile *, GFile *,
+                        GFileMonitorEvent event, gpointer data) {
+    switch (event) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      break;
+    default:
+      return;
+    }
+
+    auto *service = static_cast<Service *>(data);
+    if (service->debounce_ != 0) {
+      g_source_remove(service->debounce_);
+    }
+
+    constexpr guint kDebounce = 200; // ms
+    service->debounce_ = g_timeout_add(
+        kDebounce,
+        +[](gpointer data) -> gboolean {
+          auto *service = static_cast<Service *>(data);
+          service->debounce_ = 0;
+          service->reload();
+          return G_SOURCE_REMOVE;
+        },
+        service);
+  };
+
+  config_changed_ = g_signal_connect(config_monitor_, "changed",
+                                     G_CALLBACK(on_changed), this);
+}
+
+void Service::watch(std::chrono::seconds interval) {
+  if (interval.count() <= 0) {
+    return;
+  }
+  power_timer_ = g_timeout_add_seconds(
+      static_cast<guint>(interval.count()),
+      +[](gpointer data) -> gboolean {
+        static_cast<Service *>(data)->check_power();
+        return G_SOURCE_CONTINUE;
+      },
+      this);
+}
+
+void Service::check_power() {
+  PowerProfile profile = power_monitor_.sample();
+  {
+    std::lock_guard<std::mutex> lock(power_mutex_);
+    if (profile == *power_) {
+      return;
+    }
+    power_ = std::make_shared<const PowerProfile>(profile);
+  }
+
+  LOG("Power profile %s: %s", profile.name(), profile.reason.c_str());
+  queue_.resize(profile.workers(workers_));
+}
+
+std::shared_ptr<const PowerProfile> Service::power() const {
+  std::lock_guard<std::mutex> lock(power_mutex_);
+  return power_;
+}
+
+std::shared_ptr<const Inventory> Service::inventory() const {
+  std::lock_guard<std::mutex> lock(inventory_mutex_);
+  return inventory_;
+}
+
+size_t Service::subscribe(Listener listener) {
+  size_t id = next_listener_++;
+  listeners_.emplace(id, std::move(listener));
+  return id;
+}
+
+void Service::unsubscribe(size_t id) { listeners_.erase(id); }
+
+void Service::reload() {
+  std::shared_ptr<const Inventory> after;
+  try {
+    after = std::make_shared<const Inventory>(config_path_);
+  } catch (const std::exception &e) {
+    LOG("Keeping the current config, %s does not parse: %s",
+        config_path_.c_str(), e.what());
+    return;
+  }
+
+  std::shared_ptr<const Inventory> before = inventory();
+  Inventory::Diff diff = Inventory::diff(*before, *after);
+  if (diff.empty()) {
+    LOG("Reloaded %s, nothing changed", config_path_.c_str());
+    return;
+  }
+
+  LOG("Reloaded %s: %zu models added, %zu removed, %zu changed%s%s%s%s%s%s",
+      config_path_.c_str(), diff.added.size(), diff.removed.size(),
+      diff.changed.size(), diff.languages ? ", languages" : "",
+      diff.default_direction ? ", default" : "", diff.verify ? ", verify" : "",
+      diff.speculate ? ", speculate" : "", diff.tiers ? ", tiers" : "",
+      diff.refresh ? ", refresh" : "");
+
+  {
+    std::lock_guard<std::mutex> lock(inventory_mutex_);
+    inventory_ = after;
+  }
+
+  // Translators move their chains over first, loading what they now need in
+  // the background, ...
+  for (auto &[id, listener] : listeners_) {
+    listener(after, diff);
+  }
+
+  // ... after which models nothing refers to anymore can go.
+  std::vector<ModelSpec> keep = after->specs();
+  std::vector<ModelSpec> gone;
+  for (const ModelSpec &spec : before->specs()) {
+    if (std::find(keep.begin(), keep.end(), spec) == keep.end()) {
+      gone.push_back(spec);
+    }
+  }
+  model_cache().evict(gone);
+}
+
+std::optional<std::string> Service::recall(uint64_t identity,
+                                           const std::string &key) {
+  std::string memo_key = std::to_string(identity) + '\0' + key;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::optional<std::string> target = memo_.get(memo_key);
+    if (target or !persistent_) {
+      return target;
+    }
+  }
+
+  // The persistent cache locks on its own, other contexts need not wait on
+  // the disk with us.
+  std::optional<std::string> target = persistent_->get(identity, key);
+  if (target) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memo_.put(memo_key, *target);
+  }
+  return target;
+}
+
+void Service::remember(uint64_t identity, const std::string &key,
+                       const std::string &target) {
+  std::string memo_key = std::to_string(identity) + '\0' + key;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memo_.put(memo_key, target);
+  }
+  if (persistent_) {
+    persistent_->put(identity, key, target);
+  }
+}
+
+std::string ibus_slimt_t8n_socket(const YAML::Node &config) {
+  namespace fs = std::filesystem;
+  fs::path fallback =
+      fs::path(g_get_user_runtime_dir()) / "ibus-slimt-t8n.sock";
+  if (YAML::Node server = config["server"]) {
+    return server["socket"].as<std::string>(fallback.string());
+  }
+  return fallback.string();
+}
+
+WorkQueue::Workers ibus_slimt_t8n_workers(const YAML::Node &config) {
+  // Optional section, e.g.
+  //
+  //   service:
+  //     workers: 2
+  //     max_words: 1024 # most words in a batch
+  //     wrap_length: 128
+  //     cache_size: 1024 # sentences, 0 to disable
+  //     cpus: [2, 3] # any if missing
+  WorkQueue::Workers workers;
+  Config &settings = workers.config;
+  if (YAML::Node service = config["service"]) {
+    settings.workers = service["workers"].as<size_t>(settings.workers);
+    settings.max_words = service["max_words"].as<size_t>(settings.max_words);
+    settings.wrap_length =
+        service["wrap_length"].as<size_t>(settings.wrap_length);
+    settings.cache_size = service["cache_size"].as<size_t>(settings.cache_size);
+    workers.cpus = service["cpus"].as<std::vector<int>>(workers.cpus);
+  }
+  return workers;
+}
+
+} // namespace ibus::slimt::t8n
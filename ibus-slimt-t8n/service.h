@@ -0,0 +1,137 @@
+#pragma once
+#include <gio/gio.h>
+
+#include "ibus-slimt-t8n/client.h"
+#include "ibus-slimt-t8n/inventory.h"
+#include "ibus-slimt-t8n/lru.h"
+#include "ibus-slimt-t8n/model_cache.h"
+#include "ibus-slimt-t8n/persistent_cache.h"
+#include "ibus-slimt-t8n/power.h"
+#include "ibus-slimt-t8n/work_queue.h"
+#include "yaml-cpp/yaml.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace ibus::slimt::t8n {
+
+// Process-wide translation backend: a single worker pool and a single parsed
+// inventory, shared by every Translator (and so every input context) in the
+// process. Requests from all contexts land in the same queue, where slimt
+// batches them together, interactive ones ahead of the rest (see WorkQueue).
+class Service {
+public:
+  explicit Service(const std::string &config_path);
+  ~Service();
+
+  Service(const Service &) = delete;
+  Service &operator=(const Service &) = delete;
+
+  WorkQueue &queue() { return queue_; }
+
+  // The profile the service runs under at the moment, checked periodically
+  // (see PowerMonitor). Changes are logged with the reason, and resize the
+  // worker pool. Replaced, never modified, like the inventory, so checking it
+  // on every keystroke copies nothing.
+  std::shared_ptr<const PowerProfile> power() const;
+
+  // Set when the config sends translation through a server (see Server)
+  // instead of loading models in this process.
+  Client *client() { return client_.get(); }
+
+  // Marks this process as the translation server: services created from then
+  // on load models themselves, whatever the config says.
+  static void host();
+
+  // The inventory as last parsed. Replaced, never modified, when the config
+  // file changes on disk, so a snapshot stays valid for as long as it is held.
+  std::shared_ptr<const Inventory> inventory() const;
+
+  // Called on the main loop after the config has been parsed again and found
+  // to differ, with the new inventory.
+  using Listener = std::function<void(std::shared_ptr<const Inventory>,
+                                      const Inventory::Diff &)>;
+  size_t subscribe(Listener listener);
+  void unsubscribe(size_t id);
+
+  // Parses the config again, and hands the result to subscribers if anything
+  // changed. Models no longer in the config are unloaded. A config that fails
+  // to parse is logged and ignored.
+  void reload();
+
+  // Memo of translated sentences, keyed by the identity of the chain that
+  // translates them (see Inventory::identity) and the direction-qualified,
+  // normalized source sentence. Shared across contexts, so boilerplate typed
+  // in one window is already warm in the next. Backed by a persistent cache
+  // when enabled in the config, so it is also warm across restarts.
+  std::optional<std::string> recall(uint64_t identity, const std::string &key);
+  void remember(uint64_t identity, const std::string &key,
+                const std::string &target);
+
+  // Returns the live service for config_path, constructing one if nobody
+  // holds it at the moment.
+  static std::shared_ptr<Service> shared(const std::string &config_path);
+
+private:
+  static constexpr size_t kMemoCapacity = 4096;
+
+  // Evicts idle models on a timer, and models in general when the system
+  // reports memory pressure.
+  void watch(const ModelCache::Limits &limits);
+
+  // Reloads when the config file changes.
+  void watch(const std::string &config_path);
+
+  // Checks the power profile every interval.
+  void watch(std::chrono::seconds interval);
+  void check_power();
+
+  std::string config_path_;
+  mutable std::mutex inventory_mutex_;
+  std::shared_ptr<const Inventory> inventory_;
+
+  // Declared before queue_, which starts out at the profile's worker count.
+  PowerMonitor power_monitor_;
+  mutable std::mutex power_mutex_;
+  std::shared_ptr<const PowerProfile> power_;
+  size_t workers_;
+  guint power_timer_ = 0;
+
+  WorkQueue queue_;
+
+  std::unordered_map<size_t, Listener> listeners_;
+  size_t next_listener_ = 0;
+
+  std::mutex mutex_;
+  LRU<std::string, std::string> memo_{kMemoCapacity};
+  std::unique_ptr<PersistentCache> persistent_;
+
+  std::unique_ptr<Client> client_;
+
+  guint reaper_ = 0;
+
+  GFileMonitor *config_monitor_ = nullptr;
+  gulong config_changed_ = 0;
+  // Editors tend to write a file in several steps, reload once they are done.
+  guint debounce_ = 0;
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  GMemoryMonitor *monitor_ = nullptr;
+  gulong pressure_ = 0;
+#endif
+};
+
+// Where the translation server listens, from the server section of config.
+std::string ibus_slimt_t8n_socket(const YAML::Node &config);
+
+// The worker pool, from the service section of config. slimt defaults for
+// whatever is missing.
+WorkQueue::Workers ibus_slimt_t8n_workers(const YAML::Node &config);
+
+} // namespace ibus::slimt::t8n
@@ -1,7 +1,13 @@
 #include "ibus-slimt-t8n/slimt_engine.h"
 #include "ibus-slimt-t8n/engine_compat.h"
+#include "ibus-slimt-t8n/main_loop.h"
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <chrono>
+#include <cstdio>
 #include <filesystem>
+#include <functional>
 #include <glib.h>
 #include <string>
 #include <vector>
@@ -15,11 +21,34 @@ template <class T8r> T8r make() {
   return T8r(config);
 }
 
+template <class T8r>
+RefreshScheduler make_scheduler(const T8r &translator) {
+  Inventory::Refresh refresh = translator.refresh();
+  return RefreshScheduler(refresh.target, refresh.policy);
+}
+
+// For logs, e.g. "pivot 84.2 ms, backtranslate 31.0 ms".
+std::string describe(const Translator::Latency &latency) {
+  auto format = [](const char *step,
+                   const std::optional<Translator::Milliseconds> &cost) {
+    if (not cost) {
+      return std::string(step) + " unmeasured";
+    }
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%s %.1f ms", step, cost->count());
+    return std::string(buffer);
+  };
+  return format(latency.pivot ? "pivot" : "translate", latency.forward) +
+         ", " + format("backtranslate", latency.backward);
+}
+
 } // namespace
 
-g::PropList SlimtEngine::make_children(const std::string &side,
-                                       const StringSet &languages,
-                                       const std::string &default_language) {
+template <class T8r>
+g::PropList
+BasicSlimtEngine<T8r>::make_children(const std::string &side,
+                                     const StringSet &languages,
+                                     const std::string &default_language) {
   bool first = false;
   g::PropList properties;
   for (const auto &lang : languages) {
@@ -45,10 +74,12 @@ g::PropList SlimtEngine::make_children(const std::string &side,
   return properties;
 }
 
-SlimtEngine::Select SlimtEngine::make_select(const std::string &key,     //
-                                             const std::string &tooltip, //
-                                             const StringSet &languages, //
-                                             const std::string &value    //
+template <class T8r>
+typename BasicSlimtEngine<T8r>::Select
+BasicSlimtEngine<T8r>::make_select(const std::string &key,     //
+                                   const std::string &tooltip, //
+                                   const StringSet &languages, //
+                                   const std::string &value    //
 ) {
   const gchar *gkey = key.c_str();
   const gchar *icon = nullptr;
@@ -69,7 +100,8 @@ SlimtEngine::Select SlimtEngine::make_select(const std::string &key,     //
   return select;
 }
 
-g::Property SlimtEngine::make_verify(bool enable_sensitive) { //
+template <class T8r>
+g::Property BasicSlimtEngine<T8r>::make_verify(bool enable_sensitive) { //
   const gchar *icon = nullptr;
   g::Text glabel("verify");
   g::Text gtooltip("Verify with backtranslated text as second candidate.");
@@ -82,21 +114,29 @@ g::Property SlimtEngine::make_verify(bool enable_sensitive) { //
   return verify;
 }
 
-SlimtEngine::UI SlimtEngine::make_ui(Translator &translator) {
-
+template <class T8r>
+typename BasicSlimtEngine<T8r>::UI
+BasicSlimtEngine<T8r>::make_ui(T8r &translator) {
   Direction direction = translator.default_direction();
   translator.set_direction(direction);
+  bool enable_sensitive = true;
+  return make_ui(translator.languages(), direction, enable_sensitive);
+}
 
-  Select source = make_select(       //
-      "source", "Source language",   //
-      translator.languages().source, //
+template <class T8r>
+typename BasicSlimtEngine<T8r>::UI
+BasicSlimtEngine<T8r>::make_ui(const Languages &languages,
+                               const Direction &direction,
+                               bool enable_sensitive) {
+  Select source = make_select(     //
+      "source", "Source language", //
+      languages.source,            //
       direction.source);
-  Select target = make_select(       //
-      "target", "Target language",   //
-      translator.languages().target, //
+  Select target = make_select(     //
+      "target", "Target language", //
+      languages.target,            //
       direction.target);
 
-  bool enable_sensitive = true;
   auto verify = make_verify(enable_sensitive);
 
   // Assign UI.
@@ -108,17 +148,35 @@ SlimtEngine::UI SlimtEngine::make_ui(Translator &translator) {
 }
 
 /* constructor */
-SlimtEngine::SlimtEngine(IBusEngine *engine)
-    : Engine(engine), translator_(make<Translator>()),
-      ui_(make_ui(translator_)) {
+template <class T8r>
+BasicSlimtEngine<T8r>::BasicSlimtEngine(IBusEngine *engine)
+    : Engine(engine), translator_(make<T8r>()),
+      scheduler_(make_scheduler(translator_)), ui_(make_ui(translator_)) {
+  translator_.on_reload([this] { on_reload(); });
   LOG("slimt-t8n engine started");
 }
 
+template <class T8r>
+BasicSlimtEngine<T8r>::BasicSlimtEngine(std::unique_ptr<Backend> backend)
+    : Engine(std::move(backend)), translator_(make<T8r>()),
+      scheduler_(make_scheduler(translator_)), ui_(make_ui(translator_)) {
+  translator_.on_reload([this] { on_reload(); });
+  LOG("slimt-t8n engine started (headless)");
+}
+
 /* destructor */
-SlimtEngine::~SlimtEngine() { hide_lookup_table(); }
+template <class T8r>
+BasicSlimtEngine<T8r>::~BasicSlimtEngine() {
+  drop_speculation();
+  drop_refresh();
+  hide_lookup_table();
+  log_stats();
+}
 
-gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
-                                        guint modifiers) {
+template <class T8r>
+gboolean BasicSlimtEngine<T8r>::process_key_event(guint keyval,
+                                                  guint /*keycode*/,
+                                                  guint modifiers) {
   // If both langs are set to equal, translation mechanism needn't kick in.
   if (translator_.direction().source == translator_.direction().target) {
     return 0;
@@ -131,13 +189,19 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
     return FALSE;
   }
 
+  drop_speculation();
+
   // We are skipping any modifiers. Our workflow is simple. Ctrl-Enter key is
   // send.
   if (modifiers & IBUS_CONTROL_MASK && keyval == IBUS_Return) {
+    settle();
+    refine();
     g::Text text(buffer_.target);
     commit_text(text);
     buffer_.source.clear();
     buffer_.target.clear();
+    backtranslation_.reset();
+    ++generation_;
     hide_lookup_table();
     return TRUE;
   }
@@ -153,7 +217,7 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
     if (buffer_.source.empty()) {
       update_buffer(" ");
       commit();
-    } else if (buffer_.source.back() == ' ') {
+    } else if (buffer_.source.before() == ' ') {
       commit();
     } else {
       update_buffer(" ");
@@ -162,12 +226,12 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
 
   } break;
   case IBUS_Return: {
+    settle();
     if (buffer_.target.empty()) {
       // We have no use for empty enters.
       return 0;
     }
-    buffer_.target += "\n";
-    commit();
+    commit("\n");
     retval = TRUE;
 
   } break;
@@ -176,13 +240,44 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
       // Let the backspace through.
       retval = FALSE;
     } else {
-      buffer_.source.pop_back();
-      refresh_translation();
+      if (buffer_.source.erase_before()) {
+        request_refresh(/*boundary=*/false);
+      }
+      retval = TRUE;
+    }
+  } break;
+  case IBUS_Delete: {
+    if (buffer_.source.empty()) {
+      retval = FALSE;
+    } else {
+      if (buffer_.source.erase_after()) {
+        request_refresh(/*boundary=*/false);
+      }
       retval = TRUE;
     }
   } break;
   case IBUS_Left:
   case IBUS_Right:
+  case IBUS_Home:
+  case IBUS_End: {
+    // Move within the preedit while there is one, the application's cursor
+    // otherwise.
+    if (buffer_.source.empty()) {
+      return FALSE;
+    }
+    if (keyval == IBUS_Left) {
+      buffer_.source.left();
+    } else if (keyval == IBUS_Right) {
+      buffer_.source.right();
+    } else if (keyval == IBUS_Home) {
+      buffer_.source.home();
+    } else {
+      buffer_.source.end();
+    }
+    // Text is unchanged, so is its translation.
+    show_candidates();
+    retval = TRUE;
+  } break;
   case IBUS_Up:
   case IBUS_Down:
     return FALSE;
@@ -190,9 +285,8 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
 
   default: {
     if (isprint(static_cast<unsigned char>(keyval))) {
-      std::string append;
-      append += static_cast<unsigned char>(keyval);
-      update_buffer(append);
+      auto key = static_cast<char>(keyval);
+      update_buffer(std::string_view(&key, 1));
       retval = TRUE;
     } else {
       retval = FALSE;
@@ -202,32 +296,82 @@ gboolean SlimtEngine::process_key_event(guint keyval, guint /*keycode*/,
   return retval;
 }
 
-void SlimtEngine::update_buffer(const std::string &append) {
-  buffer_.source += append;
-  refresh_translation();
+template <class T8r>
+void BasicSlimtEngine<T8r>::update_buffer(std::string_view append) {
+  buffer_.source.insert(append);
+  auto last = static_cast<unsigned char>(append.back());
+  request_refresh(isspace(last) or ispunct(last));
 }
 
-void SlimtEngine::refresh_translation() {
-  if (!buffer_.source.empty()) {
-    std::string translation = translator_.translate(buffer_.source);
-    buffer_.target = translation;
-    std::vector<std::string> entries = {buffer_.source};
-    if (translator_.verify()) {
-      std::string backtranslation = translator_.backtranslate(translation);
-      entries.push_back(backtranslation);
-    }
-    g::LookupTable table = generate_lookup_table(entries);
-    update_lookup_table(table,
-                        /*visible=*/static_cast<gboolean>(!entries.empty()));
+template <class T8r>
+void BasicSlimtEngine<T8r>::request_refresh(bool boundary) {
+  std::chrono::milliseconds delay =
+      scheduler_.delay(boundary, translator_.power()->refresh());
+  if (delay.count() == 0 or buffer_.source.empty()) {
+    refresh_translation();
+    return;
+  }
 
-    cursor_position_ = buffer_.target.size();
-    g::Text pre_edit(buffer_.target);
-    update_preedit_text(pre_edit, cursor_position_, /*visible=*/TRUE);
-    show_lookup_table();
+  // Results for what the buffer held before this key are no use anymore.
+  drop_refresh();
+  ++generation_;
+  pending_ = true;
+  refresh_ = g_timeout_add(
+      static_cast<guint>(delay.count()),
+      +[](gpointer data) -> gboolean {
+        auto *engine = static_cast<BasicSlimtEngine *>(data);
+        engine->refresh_ = 0;
+        engine->refresh_translation();
+        return G_SOURCE_REMOVE;
+      },
+      this);
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::drop_refresh() {
+  if (refresh_ != 0) {
+    g_source_remove(refresh_);
+    refresh_ = 0;
+  }
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::refresh_translation() {
+  drop_refresh();
+  ++generation_;
+  if (!buffer_.source.empty()) {
+    // The preedit keeps showing the previous translation until the new one
+    // arrives in on_translation(...).
+    pending_ = true;
+    uint64_t generation = generation_;
+    buffer_.source.text(request_);
+    // Captures fit in std::function without a separate allocation. alive_
+    // and landing_ can be used from the dispatcher, which is joined before
+    // they go.
+    translator_.translate(
+        std::move(request_),
+        [this, generation](Translation translation) {
+          {
+            std::lock_guard<std::mutex> lock(landing_.mutex);
+            landing_.generation = generation;
+            landing_.translation = std::move(translation);
+          }
+          landing_.landed.notify_one();
+          std::weak_ptr<bool> alive = alive_;
+          invoke_on_main([this, alive, generation] {
+            if (alive.lock()) {
+              on_translation(generation);
+            }
+          });
+        },
+        buffer_.source.dirty());
   } else {
     // Buffer is already clear (empty).
     // We will manually clear the buffer_.target.
+    pending_ = false;
+    buffer_.source.clean();
     buffer_.target.clear();
+    backtranslation_.reset();
 
     cursor_position_ = buffer_.target.size();
     g::Text pre_edit(buffer_.target);
@@ -238,21 +382,198 @@ void SlimtEngine::refresh_translation() {
   }
 }
 
-void SlimtEngine::commit() {
+template <class T8r>
+void BasicSlimtEngine<T8r>::on_translation(uint64_t generation) {
+  std::optional<Translation> landed;
+  {
+    std::lock_guard<std::mutex> lock(landing_.mutex);
+    if (landing_.generation != generation or not landing_.translation) {
+      // Taken by settle(), or by the hop for an earlier result of the same
+      // request.
+      return;
+    }
+    landed.swap(landing_.translation);
+  }
+
+  Translation &translation = *landed;
+  if (not translation.provisional) {
+    // Ours again, for the next request.
+    request_ = std::move(translation.source);
+  }
+
+  if (generation != generation_) {
+    // Buffer has moved on since this was requested.
+    return;
+  }
+
+  // A provisional result only tides us over until models load, the real one
+  // is still on its way.
+  pending_ = translation.provisional;
+  if (not translation.provisional) {
+    buffer_.source.clean();
+  }
+  buffer_.target = std::move(translation.target);
+  backtranslation_ = std::move(translation.backtranslation);
+
+  cursor_position_ = buffer_.target.size();
+  g::Text pre_edit(buffer_.target);
+  update_preedit_text(pre_edit, cursor_position_, /*visible=*/TRUE);
+  show_candidates();
+
+  if (not pending_) {
+    adapt();
+    schedule_speculation();
+  }
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::adapt() {
+  Translator::Latency latency = translator_.latency(translator_.direction());
+  if (not latency.forward) {
+    return;
+  }
+
+  Translator::Milliseconds cost = *latency.forward;
+  if (translator_.verify() and latency.backward) {
+    cost += *latency.backward;
+  }
+
+  if (scheduler_.update(cost)) {
+    LOG("Refresh policy now %s, target %ld ms: %s",
+        RefreshScheduler::name(scheduler_.policy()),
+        static_cast<long>(scheduler_.target().count()),
+        describe(latency).c_str());
+  }
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::schedule_speculation() {
+  // Guesses are about what follows the end of the buffer.
+  if (speculation_ != 0 or
+      buffer_.source.cursor() != buffer_.source.size()) {
+    return;
+  }
+
+  speculation_ = g_idle_add_full(
+      G_PRIORITY_LOW,
+      +[](gpointer data) -> gboolean {
+        auto *engine = static_cast<BasicSlimtEngine *>(data);
+        engine->speculation_ = 0;
+        engine->translator_.speculate(engine->buffer_.source.text());
+        return G_SOURCE_REMOVE;
+      },
+      this, nullptr);
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::drop_speculation() {
+  if (speculation_ != 0) {
+    g_source_remove(speculation_);
+    speculation_ = 0;
+  }
+  translator_.drop_speculation();
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::show_candidates() {
+  candidate_.reserve(buffer_.source.size() + 1);
+  buffer_.source.text(candidate_);
+  if (buffer_.source.cursor() < candidate_.size()) {
+    // The preedit shows the translation, this is the only place the cursor
+    // can be seen.
+    candidate_.insert(buffer_.source.cursor(), 1, '|');
+  }
+
+  table_.clear();
+  g::Text source(candidate_);
+  table_.append_candidate(source.get());
+  if (backtranslation_) {
+    g::Text backtranslation(*backtranslation_);
+    table_.append_candidate(backtranslation.get());
+  }
+
+  // Both candidates fit on the first page, the only one the fast update
+  // sends.
+  update_lookup_table_fast(table_, /*visible=*/TRUE);
+  show_lookup_table();
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::settle() {
+  // Commits must carry the translation of what is in the buffer now. The
+  // request for it is usually in flight already, so we wait for it to land
+  // rather than start over. Not on a model still loading, nor for longer than
+  // kSettle: the source goes out as typed then, the same the dispatcher shows
+  // meanwhile.
+  constexpr std::chrono::seconds kSettle(1);
+  if (refresh_ != 0) {
+    // Held back by the scheduler, off it goes.
+    refresh_translation();
+  }
+  if (not pending_) {
+    return;
+  }
+
+  std::optional<Translation> landed;
+  if (not translator_.loading()) {
+    auto done = [this] {
+      return landing_.generation == generation_ and landing_.translation and
+             not landing_.translation->provisional;
+    };
+    std::unique_lock<std::mutex> lock(landing_.mutex);
+    if (landing_.landed.wait_for(lock, kSettle, done)) {
+      landed.swap(landing_.translation);
+    }
+  }
+
+  if (landed) {
+    request_ = std::move(landed->source);
+    buffer_.target = std::move(landed->target);
+  } else {
+    translator_.cancel();
+    buffer_.target = buffer_.source.text();
+  }
+  pending_ = false;
+  ++generation_;
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::refine() {
+  // Better translation if it makes it in time, else the preview stands.
+  std::optional<std::string> target =
+      translator_.refine(buffer_.source.text());
+  if (target) {
+    buffer_.target = std::move(*target);
+  }
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::commit(const std::string &suffix) {
+  settle();
+  refine();
+  buffer_.target += suffix;
   g::Text text(buffer_.target);
   commit_text(text);
   hide_lookup_table();
 
   buffer_.source.clear();
   buffer_.target.clear();
+  backtranslation_.reset();
+  ++generation_;
 
-  hide_lookup_table();
   cursor_position_ = 0;
   g::Text pre_edit("");
   update_preedit_text(pre_edit, cursor_position_, TRUE);
 }
 
-void SlimtEngine::focus_in() {
+template <class T8r>
+void BasicSlimtEngine<T8r>::focus_in() {
+  focused_ = true;
+  register_ui();
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::register_ui() {
   g::PropList properties;
   properties.append(ui_.source.node);
   properties.append(ui_.target.node);
@@ -260,33 +581,117 @@ void SlimtEngine::focus_in() {
   register_properties(properties);
 }
 
-void SlimtEngine::focus_out() {
+template <class T8r>
+void BasicSlimtEngine<T8r>::on_reload() {
+  // Stay on the current direction if the config still offers it.
+  Direction direction = translator_.direction();
+  const Languages &languages = translator_.languages();
+  if (languages.source.count(direction.source) == 0 or
+      languages.target.count(direction.target) == 0) {
+    direction = translator_.default_direction();
+    translator_.set_direction(direction);
+  }
+
+  // Built on the side and swapped in whole, so the panel only ever sees the
+  // old menus or the new ones.
+  ui_ = make_ui(languages, direction, translator_.verifiable());
+  if (focused_) {
+    register_ui();
+  }
+
+  // Starts over from the config, what latency was measured still stands.
+  scheduler_ = make_scheduler(translator_);
+  adapt();
+
+  // The buffer survives, its translation may be due for an update.
+  if (!buffer_.source.empty()) {
+    refresh_translation();
+  }
+}
+
+template <class T8r>
+void BasicSlimtEngine<T8r>::focus_out() {
+  focused_ = false;
+  drop_speculation();
+  drop_refresh();
   buffer_.source.clear();
   buffer_.target.clear();
+  backtranslation_.reset();
+  pending_ = false;
+  ++generation_;
+  translator_.cancel();
   Engine::focus_out();
 }
 
-void SlimtEngine::reset() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::log_stats() {
+  Translator::Stats stats = translator_.stats();
+  LOG("Requests: %zu submitted, %zu completed, %zu coalesced, %zu cancelled",
+      stats.submitted, stats.completed, stats.coalesced, stats.cancelled);
+  LOG("Sentences: %zu seen, %zu memoized, %zu reused", stats.sentences,
+      stats.memoized, stats.reused);
+  LOG("Commits: %zu refined, %zu over budget", stats.refined, stats.expired);
+  LOG("Speculation: %zu sentences, %zu hits (%.0f%%), %zu wasted, %.2f ms "
+      "of model time wasted",
+      stats.speculated, stats.speculation_hits,
+      stats.speculated ? 100.0 * stats.speculation_hits / stats.speculated : 0,
+      stats.speculation_wasted, stats.wasted_time.count() / 1000.0);
+  std::shared_ptr<const PowerProfile> power = translator_.power();
+  LOG("Power: %s profile, %s", power->name(), power->reason.c_str());
+  const CoalescingBackend::Stats &messages = output();
+  LOG("Output: %zu updates, %zu sent, %zu suppressed", messages.received,
+      messages.sent, messages.suppressed());
+  LOG("Refresh: %s policy, target %ld ms, %s",
+      RefreshScheduler::name(std::max(scheduler_.policy(), power->refresh())),
+      static_cast<long>(scheduler_.target().count()),
+      describe(translator_.latency(translator_.direction())).c_str());
+  std::array<WorkQueue::Stats, kPriorities> queues = translator_.queues();
+  for (size_t i = 0; i < kPriorities; i++) {
+    const WorkQueue::Stats &queue = queues[i];
+    size_t handed = queue.submitted - queue.queued;
+    LOG("Queue %s: %zu submitted, %zu waiting (at most %zu), waited %.2f ms "
+        "on average, %.2f ms at most",
+        name(static_cast<Priority>(i)), queue.submitted, queue.queued,
+        queue.peak, handed ? queue.waited.count() / 1000.0 / handed : 0,
+        queue.longest.count() / 1000.0);
+  }
+  for (const ModelCache::Resident &model : model_cache().residents()) {
+    LOG("Resident: %s (%s), %zu of %zu bytes in memory, idle %ld s",
+        model.path.c_str(), model.arch.c_str(), model.resident, model.size,
+        static_cast<long>(model.idle.count()));
+  }
+}
 
-void SlimtEngine::enable() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::reset() {}
 
-void SlimtEngine::disable() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::enable() {}
 
-void SlimtEngine::page_up() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::disable() {}
 
-void SlimtEngine::page_down() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::page_up() {}
 
-void SlimtEngine::cursor_up() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::page_down() {}
 
-void SlimtEngine::cursor_down() {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::cursor_up() {}
 
-inline void SlimtEngine::show_setup_dialog() {
+template <class T8r>
+void BasicSlimtEngine<T8r>::cursor_down() {}
+
+template <class T8r>
+inline void BasicSlimtEngine<T8r>::show_setup_dialog() {
   // g_spawn_command_line_async(LIBEXECDIR "/ibus-setup-libzhuyin zhuyin",
   // NULL);
 }
 
-gboolean SlimtEngine::property_activate(const char *cprop_name,
-                                        guint prop_state) {
+template <class T8r>
+gboolean BasicSlimtEngine<T8r>::property_activate(const char *cprop_name,
+                                                  guint prop_state) {
   std::string prop_name(cprop_name);
   Direction direction = translator_.direction();
   if (prop_name == "verify") {
@@ -320,16 +725,11 @@ gboolean SlimtEngine::property_activate(const char *cprop_name,
   return FALSE;
 }
 
-void SlimtEngine::candidate_clicked(guint index, guint button, guint state) {}
+template <class T8r>
+void BasicSlimtEngine<T8r>::candidate_clicked(guint index, guint button,
+                                              guint state) {}
 
-g::LookupTable
-SlimtEngine::generate_lookup_table(const std::vector<std::string> &entries) {
-  g::LookupTable lookup_table;
-  for (const auto &entry : entries) {
-    g::Text text(entry);
-    lookup_table.append_candidate(text.get());
-  }
-  return lookup_table;
-}
+template class BasicSlimtEngine<Translator>;
+template class BasicSlimtEngine<FakeTranslator>;
 
 } // namespace ibus::slimt::t8n
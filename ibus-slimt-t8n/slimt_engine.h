@@ -1,10 +1,18 @@
 #pragma once
 
 #include "ibus-slimt-t8n/engine_compat.h"
+#include "ibus-slimt-t8n/fake_translator.h"
+#include "ibus-slimt-t8n/gap_buffer.h"
+#include "ibus-slimt-t8n/refresh_scheduler.h"
 #include "ibus-slimt-t8n/translator.h"
+#include <condition_variable>
+#include <cstdint>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
 
 namespace ibus::slimt::t8n {
 
@@ -12,10 +20,17 @@ namespace ibus::slimt::t8n {
 //
 // 1. The first suggestion is the translated text.
 // 2. The second suggestion is the raw text the user entered.
-class SlimtEngine : public Engine {
+//
+// T8r is Translator, or FakeTranslator to run without models. Members are
+// defined in slimt_engine.cpp, which instantiates both.
+template <class T8r> class BasicSlimtEngine : public Engine {
 public:
-  explicit SlimtEngine(IBusEngine *engine);
-  ~SlimtEngine() override;
+  explicit BasicSlimtEngine(IBusEngine *engine);
+  explicit BasicSlimtEngine(std::unique_ptr<Backend> backend);
+  ~BasicSlimtEngine() override;
+
+  // Whether the preedit is still waiting on a translation of the buffer.
+  bool pending() const { return pending_; }
 
   // virtual functions
   gboolean process_key_event(guint keyval, guint keycode,
@@ -35,18 +50,100 @@ public:
 private:
   void show_setup_dialog();
 
-  static g::LookupTable
-  generate_lookup_table(const std::vector<std::string> &entries);
-
-  void update_buffer(const std::string &append);
+  void update_buffer(std::string_view append);
   void refresh_translation();
-  void commit();
 
-  Pair<std::string> buffer_;
+  // Refreshes now or after a delay, as the scheduler sees fit for the cost of
+  // a translation. boundary is whether the last key ended a word. Until the
+  // refresh happens, the preedit shows the previous translation and pending()
+  // holds.
+  void request_refresh(bool boundary);
+  void drop_refresh();
+
+  // Feeds the scheduler with what translations cost lately.
+  void adapt();
+
+  // Shows the source, with the cursor in it, and the backtranslation if any.
+  void show_candidates();
+
+  // Hands the buffer to the translator to guess ahead once the main loop has
+  // nothing else to do, see Translator::speculate(...). Any key drops it,
+  // along with whatever the translator is still guessing.
+  void schedule_speculation();
+  void drop_speculation();
+
+  // Takes what the translator left in landing_ for generation, if nobody has
+  // yet.
+  void on_translation(uint64_t generation);
+
+  // What the translator, the queues and the output went through, once the
+  // engine goes away.
+  void log_stats();
+
+  // Brings buffer_.target up to date for a commit, see pending().
+  void settle();
+  void refine();
+  void register_ui();
+
+  // Rebuilds the property menus after the config changed on disk.
+  void on_reload();
+  void commit(const std::string &suffix = "");
+
+  // What the user typed, edited at a cursor, and its translation as shown in
+  // the preedit. The source is marked clean whenever a translation of it
+  // lands, so its dirty range is what the preedit has yet to catch up with.
+  struct Buffer {
+    GapBuffer source;
+    std::string target;
+  };
+
+  Buffer buffer_;
+  std::optional<std::string> backtranslation_;
+
+  // The buffer as last handed to the translator. It comes back with the
+  // result, in Translation::source, and carries the next request, so typing
+  // does not allocate a fresh copy of the buffer per key.
+  std::string request_;
+
+  // Kept across keys and refilled in place by show_candidates(): the table
+  // sent to IBus, and the source with the cursor marked in it.
+  g::LookupTable table_;
+  std::string candidate_;
   gint cursor_position_;
 
-  Translator translator_;
+  // Bumped whenever buffer_.source changes or is committed. Results of
+  // requests made for an older generation are dropped on arrival.
+  uint64_t generation_ = 0;
+
+  // Whether buffer_.target lags behind buffer_.source, waiting on a request.
+  bool pending_ = false;
+
+  bool focused_ = false;
+
+  // Idle source for schedule_speculation(), 0 if none.
+  guint speculation_ = 0;
+
+  // Timeout source for request_refresh(...), 0 if none.
+  guint refresh_ = 0;
+
+  // Callbacks from the translator hold a weak reference to this, so results
+  // that land after the engine is destroyed are discarded.
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+
+  // The latest result from the translator, left by the dispatcher for
+  // on_translation(...) to pick up on the main loop, or for settle() to wait
+  // on without the main loop.
+  struct Landing {
+    std::mutex mutex;
+    std::condition_variable landed;
+    uint64_t generation = 0;
+    std::optional<Translation> translation;
+  };
+  Landing landing_;
+
+  T8r translator_;
   Direction direction_;
+  RefreshScheduler scheduler_;
 
   struct Select {
     g::Property node;
@@ -61,7 +158,9 @@ private:
 
   UI ui_;
 
-  static UI make_ui(Translator &translator);
+  static UI make_ui(T8r &translator);
+  static UI make_ui(const Languages &languages, const Direction &direction,
+                   bool enable_sensitive);
   static g::PropList make_children(const std::string &side,
                                    const StringSet &languages,
                                    const std::string &default_language);
@@ -74,4 +173,10 @@ private:
   static g::Property make_verify(bool enable_sensitive);
 };
 
+extern template class BasicSlimtEngine<Translator>;
+extern template class BasicSlimtEngine<FakeTranslator>;
+
+using SlimtEngine = BasicSlimtEngine<Translator>;
+using FakeSlimtEngine = BasicSlimtEngine<FakeTranslator>;
+
 } // namespace ibus::slimt::t8n
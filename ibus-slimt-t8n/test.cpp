@@ -1,7 +1,18 @@
+#include "ibus-slimt-t8n/fake_translator.h"
 #include "ibus-slimt-t8n/logging.h"
+#include "ibus-slimt-t8n/segmenter.h"
 #include "ibus-slimt-t8n/translator.h"
+#include <chrono>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <vector>
+
+using Direction = ibus::slimt::t8n::Direction;
 
 template <class Translator> void repl(const std::string &config) {
   std::cout << "Type in: "
@@ -10,7 +21,6 @@ template <class Translator> void repl(const std::string &config) {
             << "<source_lang> <target_lang> <input> \n";
 
   std::string input;
-  using Direction = ibus::slimt::t8n::Direction;
   Direction old;
   Direction current;
   Translator translator(config);
@@ -31,10 +41,201 @@ template <class Translator> void repl(const std::string &config) {
   }
 }
 
+struct Batch {
+  // Every line is translated in this direction if set. Otherwise lines are
+  // in the REPL format, <source_lang> <target_lang> <input>.
+  std::optional<Direction> direction;
+
+  // Most requests in flight at once.
+  size_t window = 64;
+
+  // Read in order, stdin if none.
+  std::vector<std::string> files;
+};
+
+// Translates line by line, writing one line out per line in, in order. Many
+// lines are in flight at once, so their sentences batch together on the
+// workers. Throughput goes to stderr at the end.
+template <class Translator>
+void batch(const std::string &config, const Batch &options) {
+  Translator translator(config);
+  std::deque<std::future<std::string>> inflight;
+  size_t lines = 0;
+  size_t sentences = 0;
+  size_t tokens = 0;
+
+  auto drain = [&inflight](size_t keep) {
+    while (inflight.size() > keep) {
+      std::cout << inflight.front().get() << "\n";
+      inflight.pop_front();
+    }
+  };
+
+  auto run = [&](std::istream &in) {
+    std::string line;
+    while (std::getline(in, line)) {
+      Direction direction;
+      std::string text;
+      if (options.direction) {
+        direction = *options.direction;
+        text = std::move(line);
+      } else {
+        std::istringstream stream(line);
+        stream >> direction.source >> direction.target >> std::ws;
+        std::getline(stream, text);
+      }
+
+      ++lines;
+      sentences += ibus::slimt::t8n::segment(text).size();
+      std::istringstream words(text);
+      for (std::string word; words >> word;) {
+        ++tokens;
+      }
+
+      inflight.push_back(translator.submit(direction, std::move(text)));
+      drain(options.window);
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  if (options.files.empty()) {
+    run(std::cin);
+  } else {
+    for (const std::string &path : options.files) {
+      std::ifstream in(path);
+      if (!in) {
+        std::cerr << "Unable to open " << path << "\n";
+        continue;
+      }
+      run(in);
+    }
+  }
+  drain(0);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  double seconds = elapsed.count();
+  auto rate = [seconds](size_t count) {
+    return seconds > 0 ? count / seconds : 0;
+  };
+
+  std::cerr << lines << " lines, " << sentences << " sentences, " << tokens
+            << " tokens in " << seconds << " s: " << rate(sentences)
+            << " sentences/s, " << rate(tokens) << " tokens/s\n";
+}
+
+// Translates each input whole, the way a paste lands in the engine, writing
+// the translation out and to stderr how soon the first sentences showed and
+// how long the rest took. Run with different worker counts (see service: in
+// the config) to see how it scales.
+void paste(const std::string &config, const Batch &options) {
+  using Clock = std::chrono::steady_clock;
+  ibus::slimt::t8n::Translator translator(config);
+  if (options.direction) {
+    translator.set_direction(*options.direction);
+  }
+  // Models load outside the clock.
+  translator.translate(std::string());
+
+  auto workers =
+      ibus::slimt::t8n::ibus_slimt_t8n_workers(YAML::LoadFile(config));
+  auto power = translator.power();
+  std::cerr << "Workers: " << power->workers(workers.config.workers) << " ("
+            << power->name() << " power profile)\n";
+
+  auto run = [&translator](std::istream &in) {
+    std::string text((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+    size_t sentences = ibus::slimt::t8n::segment(text).size();
+
+    std::promise<std::string> done;
+    std::optional<Clock::duration> first;
+    size_t updates = 0;
+    auto start = Clock::now();
+    translator.translate(
+        text, [&](ibus::slimt::t8n::Translation translation) {
+          if (translation.provisional) {
+            first = first.value_or(Clock::now() - start);
+            ++updates;
+            return;
+          }
+          done.set_value(std::move(translation.target));
+        });
+    std::string target = done.get_future().get();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    std::cout << target << "\n";
+    std::cerr << sentences << " sentences in " << elapsed.count() << " s ("
+              << (elapsed.count() > 0 ? sentences / elapsed.count() : 0)
+              << " sentences/s), " << updates << " partial updates";
+    if (first) {
+      std::chrono::duration<double> seconds = *first;
+      std::cerr << ", first after " << seconds.count() << " s";
+    }
+    std::cerr << "\n";
+  };
+
+  if (options.files.empty()) {
+    run(std::cin);
+  }
+  for (const std::string &path : options.files) {
+    std::ifstream in(path);
+    if (!in) {
+      std::cerr << "Unable to open " << path << "\n";
+      continue;
+    }
+    run(in);
+  }
+}
+
 int main(int argc, char **argv) {
-  std::string mode((argc == 2) ? argv[1] : "");
+  // test [fake|real] [--batch [--direction <source>:<target>] [--window <n>]
+  //                           [files...]]
+  // test [real] --paste [--direction <source>:<target>] [files...]
+  std::string mode;
+  bool batched = false;
+  bool pasted = false;
+  Batch options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--batch") {
+      batched = true;
+    } else if (arg == "--paste") {
+      pasted = true;
+    } else if (arg == "--direction" && i + 1 < argc) {
+      std::string value(argv[++i]);
+      size_t colon = value.find(':');
+      if (colon == std::string::npos) {
+        std::cerr << "--direction takes <source>:<target>\n";
+        return 1;
+      }
+      options.direction = Direction{
+          .source = value.substr(0, colon), //
+          .target = value.substr(colon + 1) //
+      };
+    } else if (arg == "--window" && i + 1 < argc) {
+      options.window = std::max<size_t>(1, std::stoul(argv[++i]));
+    } else if (mode.empty() && (arg == "fake" || arg == "real")) {
+      mode = arg;
+    } else {
+      options.files.push_back(arg);
+    }
+  }
+
   auto config = ibus::slimt::t8n::ibus_slimt_t8n_config();
-  if (mode == "fake") {
+  if (pasted) {
+    if (mode == "fake") {
+      std::cerr << "--paste needs the real translator\n";
+      return 1;
+    }
+    paste(config, options);
+  } else if (batched) {
+    if (mode == "fake") {
+      batch<ibus::slimt::t8n::FakeTranslator>(config, options);
+    } else {
+      batch<ibus::slimt::t8n::Translator>(config, options);
+    }
+  } else if (mode == "fake") {
     repl<ibus::slimt::t8n::FakeTranslator>(config);
   } else {
     repl<ibus::slimt::t8n::Translator>(config);
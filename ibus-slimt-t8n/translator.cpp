@@ -1,123 +1,57 @@
 #include "ibus-slimt-t8n/translator.h"
+#include "ibus-slimt-t8n/mapped_file.h"
+#include "ibus-slimt-t8n/model_cache.h"
+#include "ibus-slimt-t8n/segmenter.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <exception>
 #include <future>
 #include <optional>
-#include <random>
-
-#include "yaml-cpp/yaml.h"
-#include <filesystem>
+#include <thread>
 
 namespace ibus::slimt::t8n {
 
-Direction reverse(const Direction &direction) {
-  return {
-      .source = direction.target, //
-      .target = direction.source  //
-  };
-}
-
-Inventory::Inventory(const std::string &config_path) {
-  inventory_ = load(config_path);
-  using Strings = std::vector<std::string>;
-  auto select_languages = inventory_["languages"].as<Strings>();
-  select_languages_.insert(select_languages.begin(), select_languages.end());
-
-  YAML::Node models = inventory_["models"];
-  for (const YAML::Node &model : models) {
-    // std::string type = entry["type"].GetString();
-    YAML::Node node = model["direction"];
-
-    Direction direction{
-        .source = node["source"].as<std::string>(), //
-        .target = node["target"].as<std::string>()  //
-    };
-
-    auto preferred = [&, this](const std::string &lang) {
-      return select_languages_.find(lang) != select_languages_.end();
-    };
-
-    if (preferred(direction.source) and preferred(direction.target)) {
-      languages_.source.insert(direction.source);
-      languages_.target.insert(direction.target);
-    }
-
-    directions_[direction] = model;
+std::vector<Direction> Translator::legs(const Direction &direction) {
+  if (direction.source == "English" or direction.target == "English") {
+    return {direction};
   }
 
-  default_direction_ = {
-      .source = inventory_["default"]["source"].as<std::string>(), //
-      .target = inventory_["default"]["target"].as<std::string>()  //
-  };
-
-  verify_ = inventory_["verify"].as<bool>();
-}
-
-std::shared_ptr<Model> make_model(const YAML::Node &config) {
-  auto root = config["root"].as<std::string>();
-  auto prefix_root = [&root](const std::string &path) {
-    return root + "/" + path;
+  Direction to_en{
+      .source = direction.source, //
+      .target = "English"         //
   };
 
-  Package<std::string> path{
-      .model = prefix_root(config["model"].as<std::string>()), //
-      .vocabulary =
-          prefix_root(config["vocabs"]["source"].as<std::string>()),  //
-      .shortlist = prefix_root(config["shortlist"].as<std::string>()) //
+  Direction from_en{
+      .source = "English",       //
+      .target = direction.target //
   };
 
-  LOG("model_path: %s", path.model.c_str());
-  Model::Config arch = ::slimt::preset::tiny();
-  return std::make_shared<Model>(arch, path);
+  return {to_en, from_en};
 }
 
-std::shared_ptr<Model> Inventory::query(const Direction &direction) const {
-  auto query = directions_.find(direction);
-  if (query != directions_.end()) {
-    return make_model(query->second);
+uint64_t Translator::identity(const Inventory &inventory,
+                              const Direction &direction,
+                              const std::string &tier) {
+  std::vector<Direction> path = legs(direction);
+  if (path.size() == 1) {
+    return inventory.identity(path[0], tier);
   }
-  return nullptr;
-}
-
-const Languages &Inventory::languages() const { return languages_; }
-
-bool Inventory::exists(const Direction &direction) const {
-  auto query = directions_.find(direction);
-  return query != directions_.end();
-}
-
-const Direction &Inventory::default_direction() const {
-  return default_direction_;
-}
-
-bool Inventory::Equal::operator()(const Direction &lhs,
-                                  const Direction &rhs) const {
-  return lhs.source == rhs.source && lhs.target == rhs.target;
-}
-
-size_t Inventory::Hash::operator()(const Direction &direction) const {
-  auto hash_combine = [](size_t &seed, size_t next) {
-    seed ^= (std::hash<size_t>{}(next) //
-             + 0x9e3779b9              // NOLINT
-             + (seed << 6)             // NOLINT
-             + (seed >> 2)             // NOLINT
-    );
-  };
-
-  size_t seed = std::hash<std::string>{}(direction.source);
-  hash_combine(seed, std::hash<std::string>{}(direction.target));
-  return seed;
-}
 
-YAML::Node Inventory::load(const std::string &path) {
-  YAML::Node tree = YAML::LoadFile(path);
-  return tree;
+  uint64_t first = inventory.identity(path[0], tier);
+  uint64_t second = inventory.identity(path[1], tier);
+  return (first && second) ? Inventory::identity(first, second) : 0;
 }
 
-void Translator::load_model(const Direction &direction,
-                            Translator::Chain &chain) {
+Translator::Chain Translator::make_chain(const Inventory &inventory,
+                                        const Direction &direction,
+                                        const std::string &tier) {
+  Chain chain;
   if (direction.source == "English" or direction.target == "English") {
-    std::shared_ptr<Model> model = inventory_.query(direction);
+    std::shared_ptr<Model> model = inventory.query(direction, tier);
     if (model) {
       chain.first = model;
+      chain.identity = identity(inventory, direction, tier);
       LOG("Found model for (%s -> %s)", direction.source.c_str(),
           direction.target.c_str());
     } else {
@@ -136,12 +70,32 @@ void Translator::load_model(const Direction &direction,
         .target = direction.target //
     };
 
-    std::shared_ptr<Model> first = inventory_.query(to_en);
-    std::shared_ptr<Model> second = inventory_.query(from_en);
+    // Load both legs at once.
+    std::shared_ptr<Model> second;
+    std::exception_ptr failure;
+    std::thread leg([&] {
+      try {
+        second = inventory.query(from_en, tier);
+      } catch (...) {
+        failure = std::current_exception();
+      }
+    });
+    std::shared_ptr<Model> first;
+    try {
+      first = inventory.query(to_en, tier);
+    } catch (...) {
+      leg.join();
+      throw;
+    }
+    leg.join();
+    if (failure) {
+      std::rethrow_exception(failure);
+    }
 
     if (first && second) {
       chain.first = first;
       chain.second = second;
+      chain.identity = identity(inventory, direction, tier);
       LOG("Found model for (%s -> [en] -> %s)", direction.source.c_str(),
           direction.target.c_str());
     } else {
@@ -150,23 +104,196 @@ void Translator::load_model(const Direction &direction,
           second == nullptr);
     }
   }
+  return chain;
+}
+
+Translator::ChainFuture Translator::load_model(const Direction &direction,
+                                              const std::string &tier) {
+  std::promise<Chain> promise;
+  ChainFuture chain = promise.get_future().share();
+
+  if (service_->client()) {
+    // Nothing to load, the server has models of its own. Only known
+    // directions go there, the rest pass through like a missing model.
+    Chain remote;
+    remote.identity = identity(*inventory_, direction, tier);
+    remote.remote = remote.identity != 0;
+    remote.direction = direction;
+    remote.tier = tier;
+    promise.set_value(std::move(remote));
+    return chain;
+  }
+
+  // A detached thread rather than std::async: dropping the last reference to
+  // a std::async future blocks until it completes, which would stall
+  // set_direction(...) on the main loop whenever a load is superseded.
+  std::shared_ptr<const Inventory> inventory = inventory_;
+  std::thread([inventory, direction, tier, promise = std::move(promise),
+               wake = wake_dispatcher()]() mutable {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      promise.set_value(make_chain(*inventory, direction, tier));
+    } catch (const std::exception &e) {
+      LOG("Loading %s -> %s failed: %s", direction.source.c_str(),
+          direction.target.c_str(), e.what());
+      promise.set_exception(std::current_exception());
+      wake();
+      return;
+    }
+    wake();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    LOG("Chain %s -> %s (%s) ready in %ld ms", direction.source.c_str(),
+        direction.target.c_str(), tier.c_str(),
+        static_cast<long>(elapsed.count()));
+  }).detach();
+
+  return chain;
+}
+
+bool Translator::ready(const ChainFuture &chain) {
+  return chain.valid() and
+         chain.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
 }
 
 void Translator::set_direction(const Direction &direction) {
+  const Inventory::Tiers &tiers = inventory_->tiers();
   direction_ = direction;
-  load_model(direction, forward_);
+  assign(forward_, direction, tiers.preview);
+
+  // Warm up the verifying chain alongside, so toggling verify is instant.
+  assign(backward_, reverse(direction), verifiable() ? tiers.preview : "");
+
+  // The commit tier is only worth the memory if it brings different models.
+  bool refinable =
+      not tiers.commit.empty() and
+      identity(*inventory_, direction, tiers.commit) !=
+          identity(*inventory_, direction, tiers.preview);
+  assign(refine_, direction, refinable ? tiers.commit : "");
+
+  ModelCache::Stats stats = model_cache().stats();
+  LOG("Model cache: %zu hits, %zu misses, %.2f ms loading", stats.hits,
+      stats.misses, stats.load_time.count() / 1000.0);
+  MappedFile::Stats mapped = MappedFile::stats();
+  LOG("Mapped files: %zu files, %zu bytes, %zu shared", mapped.files,
+      mapped.bytes, mapped.shared);
 }
 
 void Translator::set_verify(bool verify) {
   verify_ = verify;
-  Direction back = reverse(direction_);
-  load_model(back, backward_);
+  if (verify_ and backward_.tier.empty()) {
+    assign(backward_, reverse(direction_), inventory_->tiers().preview);
+  }
+}
+
+void Translator::assign(Slot &slot, const Direction &direction,
+                        const std::string &tier) {
+  std::lock_guard<std::mutex> lock(slots_mutex_);
+  assign_locked(slot, direction, tier);
+}
+
+void Translator::assign_locked(Slot &slot, const Direction &direction,
+                               const std::string &tier) {
+  slot.direction = direction;
+  slot.tier = tier;
+  slot.chain = tier.empty() ? ChainFuture{} : load_model(direction, tier);
+}
+
+Translator::ChainFuture Translator::acquire(Slot &slot) {
+  std::lock_guard<std::mutex> lock(slots_mutex_);
+  if (not slot.tier.empty() and not slot.chain.valid()) {
+    // Evicted since last use. Until the reload lands this behaves like
+    // the first load: provisional results, verification skipped.
+    LOG("Reloading %s -> %s (%s)", slot.direction.source.c_str(),
+        slot.direction.target.c_str(), slot.tier.c_str());
+    slot.chain = load_model(slot.direction, slot.tier);
+  }
+  return slot.chain;
+}
+
+void Translator::reload(std::shared_ptr<const Inventory> inventory,
+                        const Inventory::Diff &diff) {
+  std::shared_ptr<const Inventory> before = std::move(inventory_);
+  inventory_ = std::move(inventory);
+  if (diff.verify) {
+    verify_ = inventory_->verify();
+  }
+
+  // Same as set_direction(...), except chains the new inventory serves with
+  // the same models as before are left alone.
+  auto reassign = [&](Slot &slot, const Direction &direction,
+                      const std::string &tier) {
+    bool same = slot.tier == tier and
+                slot.direction.source == direction.source and
+                slot.direction.target == direction.target and
+                identity(*before, direction, tier) ==
+                    identity(*inventory_, direction, tier);
+    if (not same) {
+      assign_locked(slot, direction, tier);
+    }
+  };
+
+  const Inventory::Tiers &tiers = inventory_->tiers();
+  bool refinable =
+      not tiers.commit.empty() and
+      identity(*inventory_, direction_, tiers.commit) !=
+          identity(*inventory_, direction_, tiers.preview);
+
+  {
+    // submit(...) adds to others_ from other threads.
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    reassign(forward_, direction_, tiers.preview);
+    reassign(backward_, reverse(direction_),
+             verifiable() ? tiers.preview : "");
+    reassign(refine_, direction_, refinable ? tiers.commit : "");
+    for (auto &[key, slot] : others_) {
+      reassign(slot, slot.direction, slot.tier);
+    }
+  }
+
+  if (on_reload_) {
+    on_reload_();
+  }
+}
+
+void Translator::on_reload(std::function<void()> callback) {
+  on_reload_ = std::move(callback);
+}
+
+void Translator::release(const ModelCache::Evicted &evicted) {
+  auto holds = [&evicted](const ModelPtr &model) {
+    return model and evicted.count(model.get()) != 0;
+  };
+
+  auto drop = [&holds](Slot &slot) {
+    if (not ready(slot.chain)) {
+      return;
+    }
+
+    try {
+      const Chain &chain = slot.chain.get();
+      if (holds(chain.first) or holds(chain.second)) {
+        slot.chain = ChainFuture{};
+      }
+    } catch (...) {
+      // Failed to load, holds nothing.
+    }
+  };
+
+  std::lock_guard<std::mutex> lock(slots_mutex_);
+  for (Slot *slot : {&forward_, &backward_, &refine_}) {
+    drop(*slot);
+  }
+  for (auto &[direction, slot] : others_) {
+    drop(slot);
+  }
 }
 
 bool Translator::verifiable() const {
   Direction back = reverse(direction_);
   if (back.source == "English" or back.target == "English") {
-    return inventory_.exists(back);
+    return inventory_->exists(back);
   } else { // NOLINT
     // Try to translate by pivoting.
     Direction to_en{
@@ -179,141 +306,747 @@ bool Translator::verifiable() const {
         .target = back.target //
     };
 
-    return inventory_.exists(to_en) and inventory_.exists(from_en);
+    return inventory_->exists(to_en) and inventory_->exists(from_en);
   }
 }
 
-std::string Translator::translate(const std::string &source) {
-  Options options{.html = false};
+Translator::Translator(const std::string &ibus_config_path)
+    : service_(Service::shared(ibus_config_path)),
+      inventory_(service_->inventory()), verify_(inventory_->verify()),
+      listener_(model_cache().subscribe(
+          [this](const ModelCache::Evicted &evicted) { release(evicted); })),
+      reload_listener_(service_->subscribe(
+          [this](std::shared_ptr<const Inventory> inventory,
+                 const Inventory::Diff &diff) {
+            reload(std::move(inventory), diff);
+          })),
+      dispatcher_([this] { dispatch(); }) {}
 
-  if (forward_.first && forward_.second) {
-    // Pivoting.
-    Handle handle =
-        service_.pivot(forward_.first, forward_.second, source, options);
-    Response response = handle.future().get();
-    return response.target.text;
+Translator::~Translator() {
+  service_->unsubscribe(reload_listener_);
+  model_cache().unsubscribe(listener_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+    // Nobody is around to see the results of anything still waiting.
+    pending_.reset();
+  }
+  work_.notify_all();
+  dispatcher_.join();
+  {
+    std::lock_guard<std::mutex> lock(waker_->mutex);
+    waker_->translator = nullptr;
   }
 
-  assert(forward_.first != nullptr);
-
-  Handle handle = service_.translate(forward_.first, source, options);
-  Response response = handle.future().get();
-  return response.target.text;
+  // Speculation still held back is of no use now.
+  service_->queue().withdraw(&speculated_);
 }
 
-std::string Translator::backtranslate(const std::string &source) {
-  Options options{.html = false};
-  if (backward_.first && backward_.second) {
-    // Pivoting.
-    Handle handle =
-        service_.pivot(backward_.first, backward_.second, source, options);
-    Response response = handle.future().get();
-    return response.target.text;
+Translator::Miss Translator::submit(Chain &chain, size_t index,
+                                   std::string source, Priority priority,
+                                   const void *tag,
+                                   std::function<void()> done) {
+  Miss miss;
+  miss.index = index;
+  if (chain.remote) {
+    miss.text = service_->client()
+                    ->translate(chain.direction.source, chain.direction.target,
+                                chain.tier, std::move(source), priority,
+                                std::move(done))
+                    .share();
+    return miss;
   }
 
-  assert(backward_.first != nullptr);
+  model_cache().touch(chain.first.get());
+  if (chain.second) {
+    model_cache().touch(chain.second.get());
+  }
 
-  Handle handle = service_.translate(backward_.first, source, options);
-  Response response = handle.future().get();
-  return response.target.text;
-}
+  assert(chain.first != nullptr);
 
-const Languages &Translator::languages() const {
-  return inventory_.languages();
+  // Models are held by the task, in case it waits in the queue while the
+  // chain is released.
+  WorkQueue::Task task = [first = chain.first, second = chain.second,
+                          source = std::move(source)](Async &async) mutable {
+    Options options{.html = false};
+    if (second) {
+      // Pivoting.
+      return async.pivot(first, second, std::move(source), options);
+    }
+    return async.translate(first, std::move(source), options);
+  };
+  miss.response = service_->queue().submit(priority, std::move(task), tag,
+                                           std::move(done));
+  return miss;
 }
 
-const Direction &Translator::default_direction() const {
-  return inventory_.default_direction();
+bool Translator::Miss::ready() const {
+  auto now = std::chrono::seconds(0);
+  return (response.valid() ? response.wait_for(now) : text.wait_for(now)) ==
+         std::future_status::ready;
 }
 
-void FakeTranslator::set_direction(const Direction &direction) {
-  direction_ = direction;
+bool Translator::Miss::failed() const {
+  if (not ready()) {
+    return false;
+  }
+  try {
+    if (response.valid()) {
+      response.get();
+    } else {
+      text.get();
+    }
+  } catch (...) {
+    return true;
+  }
+  return false;
 }
 
-void FakeTranslator::set_verify(bool verify) { verify_ = verify; }
+Translator::Pending Translator::begin(Chain &chain, const Direction &direction,
+                                      std::string source, Priority priority,
+                                      const Reuse *reuse) {
+  Pending pending;
+  pending.source = std::make_unique<std::string>(std::move(source));
+  pending.identity = chain.identity;
+  if (chain.empty()) {
+    // Nothing to translate with, pass the text through.
+    pending.passthrough = true;
+    return pending;
+  }
 
-std::string FakeTranslator::translate(std::string input) { // NOLINT
+  pending.segments = segment(*pending.source);
+  size_t count = pending.segments.size();
+  pending.keys.resize(count);
+  pending.targets.resize(count);
 
-  std::string response;
-  if (input.empty()) {
-    return response;
-  }
+  // Results of the previous request only carry over to the same models.
+  bool carry = reuse and reuse->dirty and previous_.identity == chain.identity;
 
-  // For a given length, generates a 6 length set of tokens.
-  // Entire string is changed by seeding with length each time.
-  // Simulates translation in some capacity.
-  auto transform = [](size_t length) -> std::string {
-    std::mt19937_64 generator;
-    constexpr size_t kTruncateLength = 6;
-    generator.seed(length);
-    std::string target;
-    for (size_t i = 0; i < length; i++) {
-      if (i != 0) {
-        target += " ";
+  std::string prefix = direction.source + '\0' + direction.target + '\0';
+  for (size_t i = 0; i < count; i++) {
+    std::string sentence = normalize(pending.segments[i].text);
+    pending.keys[i] = prefix + sentence;
+    if (carry and
+        not touches(*pending.source, pending.segments[i], *reuse->dirty)) {
+      auto query = previous_.targets.find(pending.keys[i]);
+      if (query != previous_.targets.end()) {
+        pending.targets[i] = query->second;
+        ++pending.reused;
+        continue;
       }
-      size_t value = generator();
-      constexpr size_t kMaxLength = 20;
-      std::string hex(kMaxLength, ' ');
-      std::sprintf(hex.data(), "%x", static_cast<unsigned int>(value));
-      // 2 to truncate 0x.
-      target += hex.substr(2, kTruncateLength);
-    }
-    return target;
-  };
+    }
 
-  auto token_count = [](const std::string &input) -> size_t {
-    std::string token;
-    size_t count = 0;
-    for (char c : input) {
-      if (isspace(c)) {
-        // Check for space.
-        if (!token.empty()) {
-          // Start of a new word.
-          ++count;
-          token = "";
+    if (reuse) {
+      auto query = speculated_.find(pending.keys[i]);
+      if (query != speculated_.end() and
+          query->second.identity == chain.identity) {
+        // Possibly still running, in which case it has a head start.
+        Speculation &speculation = query->second;
+        Miss miss = speculation.miss;
+        miss.index = i;
+        pending.misses.push_back(std::move(miss));
+        if (not speculation.free and not speculation.used) {
+          ++pending.speculated;
         }
-      } else {
-        token += std::string(1, c);
+        speculation.used = true;
+        continue;
       }
     }
-    // Non space-detected overhang.
-    if (!token.empty()) {
-      count += 1;
+
+    std::optional<std::string> target =
+        service_->recall(chain.identity, pending.keys[i]);
+    if (target) {
+      pending.targets[i] = std::move(*target);
+    } else {
+      // Submit every miss before waiting on any, so they batch together.
+      pending.misses.push_back(
+          submit(chain, i, std::move(sentence), priority));
     }
+  }
+  return pending;
+}
 
-    return count;
+std::optional<std::string> Translator::finish(Pending &pending,
+                                              Deadline deadline,
+                                              const Progress &progress) {
+  if (pending.passthrough) {
+    return *pending.source;
+  }
+
+  // Sentences before next are done.
+  auto partial = [&pending](size_t next) {
+    std::string partial;
+    for (size_t i = 0; i < next; i++) {
+      partial += pending.targets[i];
+      partial += pending.segments[i].separator;
+    }
+    size_t rest = pending.segments[next].text.data() - pending.source->data();
+    partial.append(*pending.source, rest);
+    return partial;
   };
 
-  size_t count = token_count(input);
-  std::string target = transform(count);
+  // Redrawing the preedit for every sentence of a long paste is not worth it.
+  constexpr auto kInterval = std::chrono::milliseconds(30);
+  auto last = std::chrono::steady_clock::now();
+
+  for (size_t k = 0; k < pending.misses.size(); k++) {
+    // Only worth showing if there is a wait ahead.
+    if (progress and k > 0 and not pending.misses[k].ready()) {
+      auto now = std::chrono::steady_clock::now();
+      if (now - last >= kInterval) {
+        progress(partial(pending.misses[k].index));
+        last = now;
+      }
+    }
+
+    Miss &miss = pending.misses[k];
+    size_t i = miss.index;
+    if (deadline) {
+      std::future_status status = miss.response.valid()
+                                      ? miss.response.wait_until(*deadline)
+                                      : miss.text.wait_until(*deadline);
+      if (status == std::future_status::timeout) {
+        return std::nullopt;
+      }
+    }
+
+    try {
+      pending.targets[i] = miss.response.valid()
+                               ? miss.response.get().target.text
+                               : miss.text.get();
+    } catch (const std::exception &e) {
+      // Most likely the server went away. Show the sentence as typed rather
+      // than lose it, and keep it out of the memo.
+      LOG("Translation failed: %s", e.what());
+      pending.targets[i] = std::string(pending.segments[i].text);
+      continue;
+    }
+
+    // The sentence still being typed would only evict useful entries.
+    if (pending.segments[i].finished) {
+      service_->remember(pending.identity, pending.keys[i],
+                         pending.targets[i]);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.sentences += pending.segments.size();
+    stats_.memoized +=
+        pending.segments.size() - pending.misses.size() - pending.reused;
+    stats_.reused += pending.reused;
+    stats_.speculation_hits += pending.speculated;
+  }
+
+  return stitch(pending.segments, pending.targets);
+}
+
+std::optional<std::string> Translator::translate(Chain &chain,
+                                                 const Direction &direction,
+                                                 const std::string &source,
+                                                 Priority priority,
+                                                 Deadline deadline) {
+  Pending pending = begin(chain, direction, source, priority);
+  return finish(pending, deadline);
+}
+
+Translator::ChainFuture Translator::chain(const Direction &direction,
+                                         const std::string &tier) {
+  const std::string &preview = inventory_->tiers().preview;
+  const std::string &wanted = tier.empty() ? preview : tier;
+  if (direction.source == direction_.source and
+      direction.target == direction_.target and wanted == preview) {
+    return acquire(forward_);
+  }
+
+  Slot *slot = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(slots_mutex_);
+    auto &other = others_[{direction.source, direction.target, wanted}];
+    if (other.tier.empty()) {
+      other.direction = direction;
+      other.tier = wanted;
+    }
+    slot = &other;
+  }
+  return acquire(*slot);
+}
+
+std::future<std::string> Translator::submit(const Direction &direction,
+                                            std::string source,
+                                            const std::string &tier,
+                                            Priority priority) {
+  ChainFuture future = chain(direction, tier);
+  Chain chain;
+  try {
+    chain = future.get();
+  } catch (...) {
+    // Already logged by the loader, pass through like a missing model.
+  }
+
+  Pending pending = begin(chain, direction, std::move(source), priority);
+  return std::async(std::launch::deferred,
+                    [this, pending = std::move(pending)]() mutable {
+                      return *finish(pending, std::nullopt);
+                    });
+}
+
+std::string Translator::translate(const std::string &source) {
+  // Waits for a chain still loading, the caller needs the real thing.
+  ChainFuture forward = acquire(forward_);
+  Chain chain;
+  try {
+    chain = forward.valid() ? forward.get() : Chain{};
+  } catch (...) {
+    // Already logged by the loader, carry on without a model.
+  }
+  return *translate(chain, direction_, source, Priority::Interactive);
+}
+
+bool Translator::loading() {
+  ChainFuture forward = acquire(forward_);
+  return forward.valid() and not ready(forward);
+}
+
+std::string Translator::backtranslate(const std::string &source) {
+  ChainFuture backward = acquire(backward_);
+  Chain chain;
+  try {
+    chain = backward.valid() ? backward.get() : Chain{};
+  } catch (...) {
+    // Already logged by the loader, carry on without a model.
+  }
+  return *translate(chain, reverse(direction_), source, Priority::Verify);
+}
+
+std::optional<std::string> Translator::refine(const std::string &source) {
+  // Never hold up a commit on a model that is still loading.
+  if (source.empty()) {
+    return std::nullopt;
+  }
+
+  ChainFuture refine = acquire(refine_);
+  if (not ready(refine)) {
+    return std::nullopt;
+  }
+
+  Chain chain;
+  try {
+    chain = refine.get();
+  } catch (...) {
+    // Already logged by the loader.
+    return std::nullopt;
+  }
+
+  if (chain.empty()) {
+    return std::nullopt;
+  }
+
+  auto deadline =
+      std::chrono::steady_clock::now() + inventory_->tiers().budget;
+  std::optional<std::string> target =
+      translate(chain, direction_, source, Priority::Interactive, deadline);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++(target ? stats_.refined : stats_.expired);
   return target;
 }
 
-std::string FakeTranslator::backtranslate(std::string input) {
-  return translate(std::move(input));
+void Translator::translate(std::string source, Callback callback,
+                           std::optional<Range> dirty) {
+  std::optional<ChainFuture> backward;
+  if (verify_) {
+    ChainFuture chain = acquire(backward_);
+    if (chain.valid()) {
+      backward = std::move(chain);
+    }
+  }
+
+  Job job{
+      .source = std::move(source),     //
+      .direction = direction_,         //
+      .forward = acquire(forward_),    //
+      .backward = std::move(backward), //
+      .callback = std::move(callback), //
+      .dirty = dirty                   //
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.submitted;
+    if (pending_) {
+      ++stats_.coalesced;
+    }
+    pending_ = std::move(job);
+    guess_.reset();
+    superseded_ = running_;
+  }
+  work_.notify_one();
+}
+
+void Translator::cancel() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_) {
+      ++stats_.coalesced;
+      pending_.reset();
+    }
+    guess_.reset();
+    superseded_ = running_;
+  }
+  // The dispatcher may be waiting on a chain for what was cancelled.
+  work_.notify_one();
+}
+
+void Translator::speculate(std::string source) {
+  if (not inventory_->speculate() or not service_->power()->speculate() or
+      source.empty()) {
+    return;
+  }
+
+  Guess guess{
+      .source = std::move(source),  //
+      .direction = direction_,      //
+      .forward = acquire(forward_), //
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    guess_ = std::move(guess);
+    dropped_ = false;
+  }
+  work_.notify_one();
+}
+
+void Translator::drop_speculation() {
+  // The dispatcher withdraws what it is waiting on, see speculate(Guess &).
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (dropped_) {
+      return;
+    }
+    guess_.reset();
+    dropped_ = true;
+  }
+  work_.notify_one();
+}
+
+bool Translator::await(const ChainFuture &chain) {
+  if (not chain.valid()) {
+    return true;
+  }
+
+  // load_model(...) wakes work_ once the chain is in.
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_.wait(lock, [this, &chain] {
+    return ready(chain) or superseded_ or shutdown_;
+  });
+  return ready(chain);
+}
+
+bool Translator::await(const Miss &miss) {
+  // The sentence wakes work_ once done, see speculate(Guess &).
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_.wait(lock, [this, &miss] {
+    return miss.ready() or shutdown_ or pending_.has_value() or
+           guess_.has_value() or dropped_;
+  });
+  return miss.ready();
 }
 
-const Languages &FakeTranslator::languages() const { return languages_; }
+std::function<void()> Translator::wake_dispatcher() const {
+  return [waker = waker_] {
+    std::lock_guard<std::mutex> lock(waker->mutex);
+    Translator *translator = waker->translator;
+    if (translator == nullptr) {
+      return;
+    }
+    // Taken, so the dispatcher is either yet to check what it waits for or
+    // already waiting, not in between.
+    { std::lock_guard<std::mutex> guard(translator->mutex_); }
+    translator->work_.notify_all();
+  };
+}
 
-const Direction &FakeTranslator::default_direction() const {
-  return direction_;
+void Translator::write_off() {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &[key, speculation] : speculated_) {
+    if (speculation.free or speculation.used) {
+      continue;
+    }
+    ++stats_.speculation_wasted;
+    stats_.wasted_time += std::chrono::duration_cast<std::chrono::microseconds>(
+        speculation.finished.value_or(now) - speculation.started);
+  }
+  speculated_.clear();
 }
 
-std::string ibus_slimt_t8n_config() {
-  namespace fs = std::filesystem;
-  fs::path home = std::getenv("HOME");
+void Translator::speculate(Guess &guess) {
+  using Clock = std::chrono::steady_clock;
+  write_off();
 
-  // Setup logging
-  // fs::path log_path = home / ".local" / "var" / "ibus-slimt-t8n.log";
-  // setup_logging(log_path.string());
-  // g_log("ibus-slimt-t8n",    //
-  //       G_LOG_LEVEL_MESSAGE, //
-  //       "Creating log at: %s", log_path.string().c_str());
+  if (not ready(guess.forward)) {
+    return;
+  }
+
+  Chain chain;
+  try {
+    chain = guess.forward.get();
+  } catch (...) {
+    return;
+  }
 
-  // Pickup config-defaults.
-  fs::path config = home / ".config";
-  auto path = (config / "ibus-slimt-t8n.yml").string();
-  return path;
+  // Only the sentence being typed is in play, the rest of the buffer stays
+  // the same whatever comes next.
+  std::vector<Segment> segments = segment(guess.source);
+  if (chain.empty() or segments.empty() or segments.back().finished) {
+    return;
+  }
+
+  // After punctuation, the sentence most likely ends there.
+  std::vector<std::string> next = {" "};
+  char last = guess.source.back();
+  if (last != '.' and last != '?' and last != '!' and last != ' ') {
+    next.insert(next.end(), {".", "?"});
+  }
+
+  std::string prefix =
+      guess.direction.source + '\0' + guess.direction.target + '\0';
+  for (const std::string &suffix : next) {
+    std::string candidate = guess.source + suffix;
+    std::vector<Segment> guessed = segment(candidate);
+    std::string sentence = normalize(guessed.back().text);
+    std::string key = prefix + sentence;
+    if (speculated_.count(key) != 0 or
+        service_->recall(chain.identity, key)) {
+      continue;
+    }
+
+    Speculation speculation;
+    speculation.identity = chain.identity;
+    speculation.started = Clock::now();
+
+    // A trailing space leaves the sentence as it is, but the edit touches it,
+    // so the next request would not take it from previous_ by itself.
+    auto query = previous_.targets.find(key);
+    if (previous_.identity == chain.identity and
+        query != previous_.targets.end()) {
+      std::promise<std::string> done;
+      done.set_value(query->second);
+      speculation.miss.text = done.get_future().share();
+      speculation.free = true;
+      speculated_.emplace(std::move(key), std::move(speculation));
+      continue;
+    }
+
+    speculation.miss = submit(chain, 0, std::move(sentence),
+                              Priority::Background, &speculated_,
+                              wake_dispatcher());
+    Miss miss = speculation.miss;
+    speculated_.emplace(key, std::move(speculation));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.speculated;
+    }
+
+    // One at a time, so a request arriving now waits behind at most one
+    // speculative sentence on the workers.
+    if (not await(miss)) {
+      // A request might still use it, a keystroke means nobody will. Whatever
+      // is withdrawn from the queue is of no use to anyone.
+      bool dropped = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dropped = dropped_;
+      }
+      if (dropped) {
+        service_->queue().withdraw(&speculated_);
+      }
+      if (miss.failed()) {
+        speculated_.erase(key);
+      }
+      return;
+    }
+    if (miss.failed()) {
+      speculated_.erase(key);
+      return;
+    }
+    speculated_[key].finished = Clock::now();
+  }
+}
+
+Translator::Stats Translator::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+Translator::Latency Translator::latency(const Direction &direction) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto query = latencies_.find({direction.source, direction.target});
+  return query != latencies_.end() ? query->second : Latency{};
+}
+
+void Translator::measure(const Direction &direction, bool backward, bool pivot,
+                         Milliseconds elapsed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Latency &latency = latencies_[{direction.source, direction.target}];
+  std::optional<Milliseconds> &average =
+      backward ? latency.backward : latency.forward;
+  if (average) {
+    *average = kSmoothing * elapsed + (1 - kSmoothing) * *average;
+  } else {
+    average = elapsed;
+  }
+  if (not backward) {
+    latency.pivot = pivot;
+  }
+}
+
+bool Translator::superseded() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return superseded_ or shutdown_;
+}
+
+void Translator::dispatch() {
+  while (true) {
+    Job job;
+    std::optional<Guess> guess;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      running_ = false;
+      work_.wait(lock, [this] {
+        return shutdown_ or pending_.has_value() or guess_.has_value();
+      });
+      if (shutdown_) {
+        return;
+      }
+
+      // Requests go first, speculation only runs when there are none.
+      if (pending_) {
+        job = std::move(*pending_);
+        pending_.reset();
+        running_ = true;
+        superseded_ = false;
+      } else {
+        guess = std::move(guess_);
+        guess_.reset();
+      }
+    }
+
+    if (guess) {
+      speculate(*guess);
+      continue;
+    }
+
+    if (job.forward.valid() and !ready(job.forward)) {
+      // Models are still warming up. Echo the source right away instead of
+      // leaving the user staring at nothing, then wait for the real thing,
+      // unless a newer request or shutdown makes it moot.
+      job.callback(Translation{
+          .source = job.source,            //
+          .target = job.source,            //
+          .backtranslation = std::nullopt, //
+          .provisional = true              //
+      });
+      if (not await(job.forward)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.cancelled;
+        continue;
+      }
+    }
+
+    // No chain at all (an empty preview tier) is the same as one that failed
+    // to load.
+    Chain forward;
+    try {
+      if (job.forward.valid()) {
+        forward = job.forward.get();
+      }
+    } catch (...) {
+      // Already logged by the loader, carry on without a model.
+    }
+
+    // slimt offers no way to abort a request once handed over, so a newer
+    // request can only cut this one short between steps.
+    // Only requests that had to wait on the model say anything about its
+    // cost, the rest are served from memory.
+    using Clock = std::chrono::steady_clock;
+    Translation translation;
+    if (not superseded()) {
+      auto start = Clock::now();
+      Reuse reuse{.dirty = job.dirty};
+      Pending pending = begin(forward, job.direction, job.source,
+                              Priority::Interactive, &reuse);
+      // Whatever the last guess got right is in flight for this request by
+      // now. The next keystroke makes the rest moot.
+      write_off();
+      Progress progress = [this, &job](std::string partial) {
+        if (not superseded()) {
+          job.callback(Translation{
+              .source = job.source,            //
+              .target = std::move(partial),    //
+              .backtranslation = std::nullopt, //
+              .provisional = true              //
+          });
+        }
+      };
+      bool several = pending.misses.size() > 1;
+      translation.target =
+          *finish(pending, std::nullopt, several ? progress : nullptr);
+      if (not pending.misses.empty()) {
+        measure(job.direction, /*backward=*/false, forward.second != nullptr,
+                Clock::now() - start);
+      }
+
+      previous_.identity = pending.identity;
+      previous_.targets.clear();
+      for (size_t i = 0; i < pending.keys.size(); i++) {
+        previous_.targets.emplace(std::move(pending.keys[i]),
+                                  std::move(pending.targets[i]));
+      }
+    }
+
+    // Verification is optional, skip it rather than wait on a chain that is
+    // still loading, or when the power profile rules it out.
+    if (job.backward and ready(*job.backward) and
+        service_->power()->verify() and not superseded()) {
+      try {
+        Chain backward = job.backward->get();
+        auto start = Clock::now();
+        Pending pending =
+            begin(backward, reverse(job.direction), translation.target,
+                  Priority::Verify);
+        translation.backtranslation = finish(pending, std::nullopt);
+        if (not pending.misses.empty()) {
+          measure(job.direction, /*backward=*/true, /*pivot=*/false,
+                  Clock::now() - start);
+        }
+      } catch (...) {
+        // Already logged by the loader.
+      }
+    }
+
+    if (superseded()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_.cancelled;
+      continue;
+    }
+
+    translation.source = std::move(job.source);
+    job.callback(std::move(translation));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.completed;
+  }
+}
+
+const Languages &Translator::languages() const {
+  return inventory_->languages();
+}
+
+const Direction &Translator::default_direction() const {
+  return inventory_->default_direction();
 }
 
 } // namespace ibus::slimt::t8n
@@ -1,65 +1,56 @@
 #pragma once
+#include "ibus-slimt-t8n/inventory.h"
 #include "ibus-slimt-t8n/logging.h"
+#include "ibus-slimt-t8n/model_cache.h"
+#include "ibus-slimt-t8n/power.h"
+#include "ibus-slimt-t8n/priority.h"
+#include "ibus-slimt-t8n/segmenter.h"
+#include "ibus-slimt-t8n/service.h"
+#include "ibus-slimt-t8n/work_queue.h"
 #include "slimt/slimt.hh"
-#include "yaml-cpp/yaml.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
 
 namespace ibus::slimt::t8n {
 
-template <class Field> struct Pair {
-  Field source;
-  Field target;
-};
-
-using Direction = Pair<std::string>;
-using Strings = std::vector<std::string>;
-using StringSet = std::set<std::string>;
-using Languages = Pair<StringSet>;
-
-template <class T> using Package = ::slimt::Package<T>;
-using Config = ::slimt::Config;
-using Model = ::slimt::Model;
 using Async = ::slimt::Async;
 using Options = ::slimt::Options;
 using Handle = ::slimt::Handle;
 using Response = ::slimt::Response;
 
-Direction reverse(const Direction &direction);
-
-class Inventory {
-public:
-  explicit Inventory(const std::string &config_path);
-  std::shared_ptr<Model> query(const Direction &direction) const;
-  const Languages &languages() const;
-  bool verify() const { return verify_; }
-  bool exists(const Direction &direction) const;
-  const Direction &default_direction() const;
-
-private:
-  struct Hash {
-    size_t operator()(const Direction &direction) const;
-  };
-
-  struct Equal {
-    bool operator()(const Direction &lhs, const Direction &rhs) const;
-  };
-
-  std::unordered_map<Direction, YAML::Node, Hash, Equal> directions_;
-  std::set<std::string> select_languages_;
-  Languages languages_;
-  Direction default_direction_;
-  YAML::Node inventory_;
-  bool verify_;
-  static YAML::Node load(const std::string &path);
+// Result of an asynchronous request. backtranslation is only populated when
+// verify was enabled at the time the request was made.
+//
+// A provisional translation echoes the source while models are still loading,
+// or for a source of several sentences, holds those translated so far followed
+// by the rest of the source as is. The same callback is invoked again with the
+// real translation once it is done.
+struct Translation {
+  std::string source;
+  std::string target;
+  std::optional<std::string> backtranslation;
+  bool provisional = false;
 };
 
+using Callback = std::function<void(Translation)>;
+
 class Translator {
 public:
-  explicit Translator(const std::string &ibus_config_path)
-      : service_(Config{}), inventory_(ibus_config_path),
-        verify_(inventory_.verify()) {}
+  explicit Translator(const std::string &ibus_config_path);
+  ~Translator();
 
   void set_direction(const Direction &direction);
   void set_verify(bool verify);
@@ -67,60 +58,374 @@ public:
   bool verifiable() const;
   const Direction &direction() const { return direction_; }
 
+  // Wait for the models if they are still loading. A model that failed to
+  // load passes source through.
   std::string translate(const std::string &source);
   std::string backtranslate(const std::string &source);
 
+  // Whether the preview models are still loading, in which case the next
+  // request gets a provisional echo of its source first, then waits for them.
+  bool loading();
+
+  // Queues source for translation (and backtranslation, if verify is on)
+  // without blocking the caller. callback is invoked on a dispatcher thread
+  // once the result is available, so callers owning a main-loop are expected
+  // to hop back onto it themselves.
+  //
+  // Requests are coalesced: at most one runs at a time, and at most one waits
+  // behind it. A newer request replaces the waiting one, whose callback is
+  // never invoked. A running request superseded this way skips its remaining
+  // steps and its callback.
+  //
+  // dirty is the part of source edited since the caller last used a result,
+  // if known, so it covers the edits of requests replaced on the way.
+  // Sentences clear of it are taken from the previous request where possible,
+  // including the unfinished ones the memo does not keep, so only the
+  // sentences an edit touched reach the model.
+  //
+  // Sentences go to the workers separately, so a long paste spreads across
+  // all of them. When several have to, the callback also gets provisional
+  // results as the leading ones come back, see Translation.
+  void translate(std::string source, Callback callback,
+                 std::optional<Range> dirty = std::nullopt);
+
+  // Drops the waiting request, if any, and marks the running one superseded.
+  // Also drops speculation, see speculate(...).
+  void cancel();
+
+  // For idle time between requests: translates the likely next states of
+  // source (followed by a space, or by sentence-final punctuation) ahead of
+  // time, so the request for whichever the user types next finds its last
+  // sentence done or under way. Runs on the dispatcher, one sentence at a
+  // time, and stops as soon as any other request arrives. Replaces earlier
+  // speculation. Does nothing if the config or the power profile rules it
+  // out.
+  void speculate(std::string source);
+
+  // For keystrokes: drops the guess waiting for the dispatcher, and the
+  // speculative sentence it is waiting on unless the workers have it
+  // already. Unlike cancel(), leaves requests alone.
+  void drop_speculation();
+
+  // For bulk work: starts translating source in direction and returns once
+  // its sentences are queued, without waiting on them, so many requests can
+  // be in flight and batch together. Requests are never coalesced. The result
+  // is assembled on the thread calling get(), which must happen while the
+  // translator is alive. The first request for a direction waits for its
+  // models to load. tier is the preview tier if empty. Bulk work runs at
+  // background priority unless told otherwise.
+  std::future<std::string> submit(const Direction &direction,
+                                  std::string source,
+                                  const std::string &tier = "",
+                                  Priority priority = Priority::Background);
+
+  // Retranslates source with the commit tier, for text about to leave the
+  // preedit. Gives up after the configured budget, or right away if there is
+  // no commit tier or it is still loading, in which case the caller keeps the
+  // preview.
+  std::optional<std::string> refine(const std::string &source);
+
+  struct Stats {
+    size_t submitted = 0;
+    size_t completed = 0;
+    // Replaced while waiting, never reached the model.
+    size_t coalesced = 0;
+    // Superseded while running, result discarded.
+    size_t cancelled = 0;
+    // Sentences seen across all requests, and how many of those were served
+    // from the memo instead of the model.
+    size_t sentences = 0;
+    size_t memoized = 0;
+    // Sentences clear of the edit, taken from the previous request.
+    size_t reused = 0;
+    // Commits served by the commit tier, and those that ran out of budget.
+    size_t refined = 0;
+    size_t expired = 0;
+    // Sentences speculatively handed to the model, those a request later
+    // used, and those never used along with the time the model spent on them
+    // (from submission until done or dropped).
+    size_t speculated = 0;
+    size_t speculation_hits = 0;
+    size_t speculation_wasted = 0;
+    std::chrono::microseconds wasted_time{0};
+  };
+
+  Stats stats() const;
+
+  // Of the process-wide queue to the workers, by Priority.
+  std::array<WorkQueue::Stats, kPriorities> queues() const {
+    return service_->queue().stats();
+  }
+
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+
+  // Moving average of what requests from translate(source, callback, ...)
+  // cost in a direction, measured over those that reached the model: forward
+  // is the translation (through English if pivot is set), backward the
+  // backtranslation verifying it. Empty until a request needed either.
+  struct Latency {
+    std::optional<Milliseconds> forward;
+    std::optional<Milliseconds> backward;
+    bool pivot = false;
+  };
+
+  Latency latency(const Direction &direction) const;
+
+  // Weight of the newest measurement in latency(...).
+  static constexpr double kSmoothing = 0.2;
+
+  Inventory::Refresh refresh() const { return inventory_->refresh(); }
+
+  std::shared_ptr<const PowerProfile> power() const {
+    return service_->power();
+  }
+
   const Direction &default_direction() const;
   const Languages &languages() const;
 
+  // callback runs on the main loop after the config is reloaded, once the
+  // translator has caught up with it. References previously returned by
+  // languages() and default_direction() are stale by then.
+  void on_reload(std::function<void()> callback);
+
 private:
   using ModelPtr = std::shared_ptr<Model>;
-  using Chain = std::pair<ModelPtr, ModelPtr>;
+  using Deadline = std::optional<std::chrono::steady_clock::time_point>;
 
-  void load_model(const Direction &direction, Chain &chain);
+  // second is only set when pivoting through English. first is empty if the
+  // inventory has no model for the direction.
+  //
+  // When translating through a server, models stay empty and remote is set
+  // instead, with what to ask the server for. The server pivots by itself.
+  struct Chain {
+    ModelPtr first;
+    ModelPtr second;
+    uint64_t identity = 0;
 
-  Inventory inventory_;
-  Direction direction_;
+    bool remote = false;
+    Direction direction;
+    std::string tier;
 
-  Async service_;
+    bool empty() const { return not first and not remote; }
+  };
 
-  Chain forward_;
-  Chain backward_;
+  // Chains load in the background, see load_model(...).
+  using ChainFuture = std::shared_future<Chain>;
 
-  bool verify_;
-};
+  // A chain kept around between requests, and what it takes to load it again
+  // after the model cache evicts one of its models. Unused if tier is empty.
+  struct Slot {
+    Direction direction;
+    std::string tier;
+    ChainFuture chain;
+  };
 
-class FakeTranslator {
-public:
-  explicit FakeTranslator(const std::string &){};
+  // Models are captured at submission, so a set_direction(...) or
+  // set_verify(...) that happens while the job is queued does not affect it.
+  struct Job {
+    std::string source;
+    Direction direction;
+    ChainFuture forward;
+    std::optional<ChainFuture> backward;
+    Callback callback;
+    std::optional<Range> dirty;
+  };
 
-  void set_direction(const Direction &direction);
-  void set_verify(bool verify);
+  // Sentences of the last request the dispatcher completed, by memo key.
+  struct Previous {
+    uint64_t identity = 0;
+    std::unordered_map<std::string, std::string> targets;
+  };
 
-  bool verify() const { return verify_; }
-  const Direction &direction() const { return direction_; }
+  // Waits for the dispatcher to be otherwise idle, see speculate(...).
+  struct Guess {
+    std::string source;
+    Direction direction;
+    ChainFuture forward;
+  };
 
-  std::string translate(std::string input);
-  std::string backtranslate(std::string input);
+  // Starts loading the chain for direction at tier on a background thread
+  // and returns without waiting. Pivot legs load concurrently. The
+  // dispatcher is woken once it is loaded, see await(...).
+  ChainFuture load_model(const Direction &direction, const std::string &tier);
+  static Chain make_chain(const Inventory &inventory,
+                          const Direction &direction, const std::string &tier);
 
-  const Direction &default_direction() const;
-  const Languages &languages() const;
+  // Models direction goes through: itself, or both legs of a pivot.
+  static std::vector<Direction> legs(const Direction &direction);
 
-private:
-  Languages languages_ = {
-      {"English", "German", "French"}, //
-      {"English", "German", "French"}  //
+  // Identity of the chain make_chain(...) would build, without loading it.
+  static uint64_t identity(const Inventory &inventory,
+                           const Direction &direction, const std::string &tier);
+
+  // Points slot at direction and tier and starts loading it.
+  void assign(Slot &slot, const Direction &direction, const std::string &tier);
+
+  // Same, for callers already holding slots_mutex_.
+  void assign_locked(Slot &slot, const Direction &direction,
+                     const std::string &tier);
+
+  // The chain in slot, reloading it first if it has been evicted.
+  ChainFuture acquire(Slot &slot);
+
+  // Drops chains holding any of the evicted models, so their memory can go.
+  void release(const ModelCache::Evicted &evicted);
+
+  // Switches to inventory, reloading only the chains it serves differently.
+  void reload(std::shared_ptr<const Inventory> inventory,
+              const Inventory::Diff &diff);
+  static bool ready(const ChainFuture &chain);
+
+  // A sentence handed to the model. Either the response of a model in this
+  // process, or the text itself, from a server or from previous_. Shared, so
+  // a request can wait on a sentence speculation started.
+  struct Miss {
+    size_t index = 0;
+    std::shared_future<Response> response;
+    std::shared_future<std::string> text;
+
+    bool ready() const;
+    // Ready, with an exception rather than a translation.
+    bool failed() const;
   };
 
-  Direction direction_{
-      .source = "English", //
-      .target = "German"   //
+  // tag marks the sentence for WorkQueue::withdraw(...). done is called once
+  // the sentence is in, on some other thread.
+  Miss submit(Chain &chain, size_t index, std::string source,
+             Priority priority, const void *tag = nullptr,
+             std::function<void()> done = nullptr);
+
+  // A sentence translated ahead of time, by memo key. Free if served from
+  // previous_ rather than the model, in which case it is left out of stats.
+  struct Speculation {
+    uint64_t identity = 0;
+    Miss miss;
+    bool free = false;
+    bool used = false;
+    std::chrono::steady_clock::time_point started;
+    std::optional<std::chrono::steady_clock::time_point> finished;
   };
 
-  bool verify_ = false;
+  // Handles a guess on the dispatcher.
+  void speculate(Guess &guess);
+
+  // Drops speculated_, counting what nobody used as wasted.
+  void write_off();
+
+  // Waits for miss, giving up if a request or another guess arrives first,
+  // or speculation is dropped. Only for misses submitted with
+  // wake_dispatcher() as done.
+  bool await(const Miss &miss);
+
+  // Waits for chain to load, giving up if the request is superseded or the
+  // translator shuts down. An invalid chain counts as loaded.
+  bool await(const ChainFuture &chain);
+
+  // Wakes the dispatcher, from whichever thread, for as long as the
+  // translator is around.
+  std::function<void()> wake_dispatcher() const;
+
+  // Translates source sentence by sentence, only handing sentences missing
+  // from the memo to the model, so the cost of a keystroke does not grow with
+  // everything typed before it. Returns nothing if deadline passes first.
+  std::optional<std::string> translate(Chain &chain, const Direction &direction,
+                                       const std::string &source,
+                                       Priority priority,
+                                       Deadline deadline = std::nullopt);
+
+  // What begin(...) may look at besides the memo, for the dispatcher only:
+  // previous_ for sentences clear of dirty, if set, and speculated_.
+  struct Reuse {
+    std::optional<Range> dirty;
+  };
+
+  // The two halves of translate(...): begin(...) looks sentences up in the
+  // memo and queues the misses, finish(...) waits on them.
+  struct Pending {
+    // Segments point into source, which stays put when Pending moves.
+    std::unique_ptr<std::string> source;
+    uint64_t identity = 0;
+    bool passthrough = false;
+    size_t reused = 0;
+    size_t speculated = 0;
+    std::vector<Segment> segments;
+    std::vector<std::string> keys;
+    std::vector<std::string> targets;
+    std::vector<Miss> misses;
+  };
+
+  Pending begin(Chain &chain, const Direction &direction, std::string source,
+                Priority priority, const Reuse *reuse = nullptr);
+
+  // Called by finish(...) with the sentences done so far, in order, followed
+  // by the rest of the source as is.
+  using Progress = std::function<void(std::string)>;
+
+  std::optional<std::string> finish(Pending &pending, Deadline deadline,
+                                    const Progress &progress = nullptr);
+
+  // The chain serving direction at tier, for submit(...).
+  ChainFuture chain(const Direction &direction, const std::string &tier);
+  void dispatch();
+  bool superseded() const;
+
+  // Folds a measurement into latencies_.
+  void measure(const Direction &direction, bool backward, bool pivot,
+               Milliseconds elapsed);
+
+  std::shared_ptr<Service> service_;
+  std::shared_ptr<const Inventory> inventory_;
+  Direction direction_;
+
+  std::mutex slots_mutex_;
+  Slot forward_;
+  Slot backward_;
+
+  // Unused unless the commit tier serves direction_ with other models than
+  // the preview.
+  Slot refine_;
+
+  // Directions and tiers other than those above that submit(...) has been
+  // asked for, keyed by source, target and tier.
+  std::map<std::tuple<std::string, std::string, std::string>, Slot> others_;
+
+  bool verify_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_;
+  std::optional<Job> pending_;
+  std::optional<Guess> guess_;
+  // Set by drop_speculation(), until the next guess.
+  bool dropped_ = false;
+  bool running_ = false;
+  bool superseded_ = false;
+  bool shutdown_ = false;
+  Stats stats_;
+  std::map<std::pair<std::string, std::string>, Latency> latencies_;
+
+  // Only touched by the dispatcher.
+  Previous previous_;
+  std::unordered_map<std::string, Speculation> speculated_;
+
+  // What wake_dispatcher() holds on to, so that it can outlive the
+  // translator. translator is cleared once the dispatcher is gone.
+  struct Waker {
+    explicit Waker(Translator *translator) : translator(translator) {}
+    std::mutex mutex;
+    Translator *translator;
+  };
+  std::shared_ptr<Waker> waker_ = std::make_shared<Waker>(this);
+
+  // Subscriptions to model cache evictions and config reloads.
+  size_t listener_;
+  size_t reload_listener_;
+  std::function<void()> on_reload_;
+
+  // Declared last, so everything dispatch() touches is constructed before the
+  // thread starts.
+  std::thread dispatcher_;
 };
 
 void make_translator();
-std::string ibus_slimt_t8n_config();
 
 } // namespace ibus::slimt::t8n
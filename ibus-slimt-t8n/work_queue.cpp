@@ -0,0 +1,290 @@
+#include "ibus-slimt-t8n/work_queue.h"
+#include "ibus-slimt-t8n/logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+namespace ibus::slimt::t8n {
+
+namespace {
+
+// slimt offers no hook into its workers, but they inherit the name, CPU
+// affinity and scheduling policy of the thread that starts them. So they are
+// started from one set up the way they should be. name is at most 15 bytes.
+std::unique_ptr<::slimt::Async> start(const WorkQueue::Workers &workers,
+                                      const char *name, bool idle) {
+  std::unique_ptr<::slimt::Async> async;
+  std::thread starter([&] {
+    pthread_setname_np(pthread_self(), name);
+
+    if (not workers.cpus.empty()) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int cpu : workers.cpus) {
+        CPU_SET(cpu, &cpus);
+      }
+      if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        LOG("Workers may run on any CPU: %s", strerror(errno));
+      }
+    }
+
+    if (idle) {
+      sched_param param{};
+      param.sched_priority = 0;
+      int error = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+      if (error != 0) {
+        LOG("Background workers keep the default priority: %s",
+            strerror(error));
+      }
+    }
+
+    async = std::make_unique<::slimt::Async>(workers.config);
+  });
+  starter.join();
+  return async;
+}
+
+} // namespace
+
+WorkQueue::WorkQueue(const Workers &workers, const Limits &limits)
+    : workers_(workers), limits_(limits),
+      async_(start(workers, "t8n-worker", false)) {
+  if (limits_.idle_workers != 0) {
+    Workers idle = workers;
+    idle.config.workers = limits_.idle_workers;
+    idle_ = start(idle, "t8n-idle", true);
+    idle_collector_.thread =
+        std::thread([this] { collect(idle_collector_); });
+  }
+  collector_.thread = std::thread([this] { collect(collector_); });
+  thread_ = std::thread([this] { run(); });
+}
+
+WorkQueue::~WorkQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+  }
+  work_.notify_one();
+  thread_.join();
+
+  // run() waited for held back work, but not for work with a done hook.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  handed_.notify_all();
+  collector_.thread.join();
+  if (idle_collector_.thread.joinable()) {
+    idle_collector_.thread.join();
+  }
+}
+
+std::shared_future<::slimt::Response>
+WorkQueue::submit(Priority priority, Task task, const void *tag, Done done) {
+  auto index = static_cast<size_t>(priority);
+  bool idle = priority == Priority::Background and idle_;
+  if (priority == Priority::Interactive or idle) {
+    std::shared_ptr<::slimt::Async> async;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++stats_[index].submitted;
+      async = async_;
+    }
+    ::slimt::Handle handle = task(idle ? *idle_ : *async);
+    if (not done) {
+      return std::move(handle.future()).share();
+    }
+
+    Inflight inflight{
+        .future = std::move(handle.future()), //
+        .promise = {},                        //
+        .done = std::move(done),              //
+        .held = false                         //
+    };
+    std::shared_future<::slimt::Response> future =
+        inflight.promise.get_future().share();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Collector &collector = idle ? idle_collector_ : collector_;
+      collector.inflight.push_back(std::move(inflight));
+    }
+    handed_.notify_all();
+    return future;
+  }
+
+  Item item{
+      .task = std::move(task),     //
+      .promise = {},               //
+      .queued = Clock::now(),      //
+      .tag = tag,                  //
+      .done = std::move(done)      //
+  };
+  std::shared_future<::slimt::Response> future =
+      item.promise.get_future().share();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[index].push_back(std::move(item));
+    Stats &stats = stats_[index];
+    ++stats.submitted;
+    stats.queued = queues_[index].size();
+    stats.peak = std::max(stats.peak, stats.queued);
+  }
+  work_.notify_one();
+  return future;
+}
+
+size_t WorkQueue::withdraw(const void *tag) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t dropped = 0;
+  for (size_t index = 0; index < kPriorities; index++) {
+    std::deque<Item> &queue = queues_[index];
+    auto end = std::remove_if(queue.begin(), queue.end(),
+                              [tag](const Item &item) {
+                                return item.tag == tag;
+                              });
+    dropped += queue.end() - end;
+    queue.erase(end, queue.end());
+    stats_[index].queued = queue.size();
+  }
+  return dropped;
+}
+
+void WorkQueue::resize(size_t count) {
+  Workers workers;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (workers_.config.workers == count) {
+      return;
+    }
+    workers_.config.workers = count;
+    workers = workers_;
+  }
+
+  std::shared_ptr<::slimt::Async> async = start(workers, "t8n-worker", false);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    async_.swap(async);
+  }
+
+  // The old pool finishes what it has been handed before its workers exit,
+  // which the caller need not wait for.
+  std::thread([retired = std::move(async)]() mutable { retired.reset(); })
+      .detach();
+}
+
+std::array<WorkQueue::Stats, kPriorities> WorkQueue::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+std::deque<WorkQueue::Item> *WorkQueue::next() {
+  for (std::deque<Item> &queue : queues_) {
+    if (not queue.empty()) {
+      return &queue;
+    }
+  }
+  return nullptr;
+}
+
+void WorkQueue::collect(Collector &collector) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    handed_.wait(lock, [this, &collector] {
+      return stopped_ or not collector.inflight.empty();
+    });
+    if (collector.inflight.empty()) {
+      return;
+    }
+
+    // Only this thread takes entries off, so the front stays put meanwhile.
+    Inflight &front = collector.inflight.front();
+    lock.unlock();
+    front.future.wait();
+    lock.lock();
+
+    // Workers do not necessarily finish in the order they were handed work,
+    // so whatever else is done by now goes along.
+    std::vector<Inflight> finished;
+    auto now = std::chrono::seconds(0);
+    for (auto it = collector.inflight.begin();
+         it != collector.inflight.end();) {
+      if (it->future.wait_for(now) != std::future_status::ready) {
+        ++it;
+        continue;
+      }
+      if (it->held) {
+        --inflight_;
+      }
+      finished.push_back(std::move(*it));
+      it = collector.inflight.erase(it);
+    }
+    work_.notify_one();
+
+    lock.unlock();
+    for (Inflight &inflight : finished) {
+      try {
+        inflight.promise.set_value(inflight.future.get());
+      } catch (...) {
+        inflight.promise.set_exception(std::current_exception());
+      }
+      if (inflight.done) {
+        inflight.done();
+      }
+    }
+    lock.lock();
+  }
+}
+
+void WorkQueue::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Highest priority first.
+    std::deque<Item> *queue = next();
+
+    if (shutdown_) {
+      // Whatever is still held back is dropped, its futures broken. What is
+      // with the workers is seen through.
+      if (inflight_ == 0) {
+        return;
+      }
+    } else if (queue and inflight_ < limits_.inflight) {
+      Item item = std::move(queue->front());
+      queue->pop_front();
+
+      auto index = static_cast<size_t>(queue - queues_.data());
+      auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+          Clock::now() - item.queued);
+      Stats &stats = stats_[index];
+      stats.queued = queue->size();
+      stats.waited += waited;
+      stats.longest = std::max(stats.longest, waited);
+
+      std::shared_ptr<::slimt::Async> async = async_;
+      lock.unlock();
+      ::slimt::Handle handle = item.task(*async);
+      lock.lock();
+      collector_.inflight.push_back(Inflight{
+          .future = std::move(handle.future()), //
+          .promise = std::move(item.promise),   //
+          .done = std::move(item.done),         //
+          .held = true                          //
+      });
+      ++inflight_;
+      handed_.notify_all();
+      continue;
+    }
+
+    // Woken by submit(...), by a collector, or by shutdown.
+    work_.wait(lock, [this] {
+      if (shutdown_) {
+        return inflight_ == 0;
+      }
+      return inflight_ < limits_.inflight and next() != nullptr;
+    });
+  }
+}
+
+} // namespace ibus::slimt::t8n
@@ -0,0 +1,149 @@
+#pragma once
+#include "ibus-slimt-t8n/priority.h"
+#include "slimt/slimt.hh"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ibus::slimt::t8n {
+
+// Stands between translators and the slimt workers, so that what the user is
+// waiting on goes first. slimt serves requests in the order it gets them, so
+// lower-priority work is held back here and handed over a few sentences at a
+// time, verification before background work: an interactive request finds at
+// most that much ahead of it. Interactive work is handed over right away.
+//
+// Background work can instead run on workers of its own at SCHED_IDLE, which
+// only get CPU time nothing else wants.
+class WorkQueue {
+public:
+  // How the workers are set up. Threads are named after what they serve, so
+  // they can be told apart in top and friends.
+  struct Workers {
+    ::slimt::Config config;
+    // CPUs the workers may run on, any if empty.
+    std::vector<int> cpus;
+  };
+
+  struct Limits {
+    // Most held back sentences with the workers at once.
+    size_t inflight = 2;
+    // Workers at SCHED_IDLE for background work, none if 0.
+    size_t idle_workers = 0;
+  };
+
+  // Starts one of the requests ::slimt::Async offers.
+  using Task = std::function<::slimt::Handle(::slimt::Async &)>;
+
+  // Called once the future submit(...) returned is ready, on a thread of the
+  // queue.
+  using Done = std::function<void()>;
+
+  struct Stats {
+    size_t submitted = 0;
+    // Held back at the moment, and the most there ever were.
+    size_t queued = 0;
+    size_t peak = 0;
+    // Time between submission and hand over, over all requests and at most.
+    std::chrono::microseconds waited{0};
+    std::chrono::microseconds longest{0};
+  };
+
+  WorkQueue(const Workers &workers, const Limits &limits);
+  ~WorkQueue();
+
+  WorkQueue(const WorkQueue &) = delete;
+  WorkQueue &operator=(const WorkQueue &) = delete;
+
+  // Work submitted with a tag can be withdrawn until it is handed over, see
+  // withdraw(...).
+  std::shared_future<::slimt::Response> submit(Priority priority, Task task,
+                                               const void *tag = nullptr,
+                                               Done done = nullptr);
+
+  // Drops held back work submitted with tag, breaking its futures without
+  // calling done. Work already with the workers, or that never waited here,
+  // runs to the end. Returns how much was dropped.
+  size_t withdraw(const void *tag);
+
+  // Replaces the main pool with one of count workers. Work already handed to
+  // the old pool finishes there.
+  void resize(size_t count);
+
+  // Indexed by Priority.
+  std::array<Stats, kPriorities> stats() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Item {
+    Task task;
+    std::promise<::slimt::Response> promise;
+    Clock::time_point queued;
+    const void *tag;
+    Done done;
+  };
+
+  // Work with the workers that someone needs to hear about: held back work,
+  // counted against Limits::inflight, or work with a done hook.
+  struct Inflight {
+    std::future<::slimt::Response> future;
+    std::promise<::slimt::Response> promise;
+    Done done;
+    bool held = false;
+  };
+
+  // slimt offers no way to be told when a request is done, so a thread per
+  // pool waits on what that pool has been handed, in the order handed over,
+  // passes results on and wakes run(). A list, so the thread can wait on its
+  // front without mutex_ while more is added.
+  struct Collector {
+    std::list<Inflight> inflight;
+    std::thread thread;
+  };
+
+  // Hands held back work over as the workers get through it.
+  void run();
+
+  // Passes results on for what collector has been handed.
+  void collect(Collector &collector);
+
+  // The highest priority queue holding anything. Requires mutex_.
+  std::deque<Item> *next();
+
+  Workers workers_;
+  Limits limits_;
+  // Shared with whoever is handing work over, so resize(...) can swap it.
+  std::shared_ptr<::slimt::Async> async_;
+  std::unique_ptr<::slimt::Async> idle_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable work_;
+  // Wakes the collectors when they are handed something, or to stop.
+  std::condition_variable handed_;
+  // Held back, by priority. Interactive work never waits here.
+  std::array<std::deque<Item>, kPriorities> queues_;
+  // Held back work with the workers.
+  size_t inflight_ = 0;
+  std::array<Stats, kPriorities> stats_;
+  bool shutdown_ = false;
+  // Set once run() is done, after which nothing more is handed over.
+  bool stopped_ = false;
+
+  // Declared last, so everything the threads touch is constructed before
+  // they start. The idle one is unused without idle workers.
+  Collector collector_;
+  Collector idle_collector_;
+  std::thread thread_;
+};
+
+} // namespace ibus::slimt::t8n
@@ -26,13 +26,37 @@ class IBusSlimtT8nConfig:
     def set_verify(self, verify):
         self.verify = verify
 
+    def set_cache(self, persistent):
+        self.cache = {"persistent": persistent}
+
+    def set_tiers(self, preview, commit, budget):
+        self.tiers = {"preview": preview, "budget": budget}
+        if commit:
+            self.tiers["commit"] = commit
+
     def export(self, path):
-        payload = {
-            "models": self.models,
-            "languages": list(self.languages),
-            "default": self.default,
-            "verify": self.verify,
-        }
+        # Only the keys set here are ours. The rest of an existing config
+        # (service, written by --calibrate, server, power, memory, refresh,
+        # loading, speculate, ...) is kept as it is.
+        payload = {}
+        if os.path.exists(path):
+            with open(path) as fp:
+                payload = yaml.safe_load(fp) or {}
+
+        # Size and path of the cache are left alone.
+        cache = payload.get("cache") or {}
+        cache.update(self.cache)
+
+        payload.update(
+            {
+                "models": self.models,
+                "languages": list(self.languages),
+                "default": self.default,
+                "verify": self.verify,
+                "cache": cache,
+                "tiers": self.tiers,
+            }
+        )
 
         with open(path, "w+") as fp:
             export = yaml.dump(payload, fp)
@@ -45,6 +69,7 @@ def retrieve(model_info, config_path):
         shortlist = data.get("shortlist", None)
         return {
             "name": model_info["code"],
+            "arch": model_info.get("type", "tiny"),
             "direction": {"source": model_info["src"], "target": model_info["trg"]},
             "root": dirname,
             "model": data["models"][0],
@@ -66,6 +91,10 @@ if __name__ == "__main__":
 
     parser.add_argument("--default", type=str, required=True)
     parser.add_argument("--verify", action="store_true")
+    parser.add_argument("--persistent-cache", action="store_true")
+    parser.add_argument("--preview-tier", type=str, default="tiny")
+    parser.add_argument("--commit-tier", type=str, default=None)
+    parser.add_argument("--commit-budget", type=int, default=150, help="ms")
 
     args = parser.parse_args()
     config = IBusSlimtT8nConfig()
@@ -83,6 +112,8 @@ if __name__ == "__main__":
     default_model_info = REPOSITORY.model(repository, model)
     config.set_default(default_model_info)
     config.set_verify(args.verify)
+    config.set_cache(args.persistent_cache)
+    config.set_tiers(args.preview_tier, args.commit_tier, args.commit_budget)
 
     home = os.getenv("HOME")
     ibus_slimt_t8n_config_path = os.path.join(home, ".config", "ibus-slimt-t8n.yml")